@@ -0,0 +1,3 @@
+include(${CMAKE_CURRENT_LIST_DIR}/emulator.cmake)
+
+set(KK_FAST_CRYPTO ON CACHE BOOL "")
@@ -23,11 +23,62 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+typedef struct {
+  uint16_t x;
+  uint16_t y;
+  uint16_t width;
+  uint16_t height;
+} CanvasRect;
+
 typedef struct {
   uint8_t* buffer;
   uint16_t height;
   uint16_t width;
   bool dirty;
+  /* Bounding box of the pixels drawn since the last display_refresh() */
+  CanvasRect dirty_rect;
 } Canvas;
 
+/*
+ * canvas_mark_dirty() - Grow the canvas dirty rectangle to cover an area
+ *
+ * INPUT
+ *     - canvas: canvas
+ *     - x, y, width, height: area that was drawn, clipped to the canvas
+ * OUTPUT
+ *     none
+ */
+static inline void canvas_mark_dirty(Canvas* canvas, uint16_t x, uint16_t y,
+                                     uint16_t width, uint16_t height) {
+  canvas->dirty = true;
+
+  uint32_t x1 = (uint32_t)x + width;
+  uint32_t y1 = (uint32_t)y + height;
+  if (x1 > canvas->width) x1 = canvas->width;
+  if (y1 > canvas->height) y1 = canvas->height;
+  if (x >= x1 || y >= y1) return;
+
+  CanvasRect* r = &canvas->dirty_rect;
+  if (r->width && r->height) {
+    uint32_t rx1 = (uint32_t)r->x + r->width;
+    uint32_t ry1 = (uint32_t)r->y + r->height;
+    if (r->x < x) x = r->x;
+    if (r->y < y) y = r->y;
+    if (rx1 > x1) x1 = rx1;
+    if (ry1 > y1) y1 = ry1;
+  }
+
+  r->x = x;
+  r->y = y;
+  r->width = (uint16_t)(x1 - x);
+  r->height = (uint16_t)(y1 - y);
+}
+
+/// Pack columns [x0, x1) of pages [page0, page1) of an 8-bpp canvas into the
+/// 1-bpp layout used for screenshots: byte index = x + page * width, bit
+/// y % 8 set iff the pixel is non-zero (LSB = top row of the page).
+void canvas_pack_mono(const uint8_t* buf, uint16_t width, uint16_t x0,
+                      uint16_t x1, uint16_t page0, uint16_t page1,
+                      uint8_t* out);
+
 #endif
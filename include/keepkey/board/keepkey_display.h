@@ -40,7 +40,10 @@ void display_turn_off(void);
 
 void display_constant_power(bool enabled);
 
-typedef void (*DumpDisplayCallback)(const uint8_t*);
+/// Called from display_refresh() with the canvas and the area drawn since
+/// the previous refresh (empty when nothing changed).
+typedef void (*DumpDisplayCallback)(const uint8_t* buf,
+                                    const CanvasRect* changed);
 void display_set_dump_callback(DumpDisplayCallback d);
 
 #endif
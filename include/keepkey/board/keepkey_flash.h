@@ -53,4 +53,22 @@ const char* flash_programModel(void);
 
 void flash_collectHWEntropy(bool privileged);
 void flash_readHWEntropy(uint8_t* buff, size_t size);
+
+#ifdef EMULATOR
+/// \returns a bitmap of the sector numbers erased or written since the last
+///          flash_clearDirty().
+uint32_t flash_getDirty(void);
+void flash_clearDirty(void);
+
+typedef struct {
+  uint32_t offset;  ///< Bytes from FLASH_ORIGIN
+  uint32_t len;
+} FlashRange;
+
+/// Lists the sectors in a flash_getDirty() bitmap as byte ranges, merging
+/// adjacent sectors. Only the first max_ranges are stored.
+/// \returns the total number of ranges, which may exceed max_ranges.
+size_t flash_dirtyRanges(uint32_t dirty, FlashRange* ranges,
+                         size_t max_ranges);
+#endif
 #endif
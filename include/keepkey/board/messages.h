@@ -35,6 +35,11 @@
   [ID].fields = (STRUCT_NAME##_fields), [ID].dispatch = (PARSABLE),  \
   [ID].process_func = (void (*)(void*))(PROCESS_FUNC),
 
+/* Like MSG_IN, but the length-delimited field STREAM->tag is handed to STREAM
+ * as it arrives instead of being buffered and decoded into the struct. */
+#define MSG_IN_STREAM(ID, STRUCT_NAME, PROCESS_FUNC, STREAM) \
+  MSG_IN(ID, STRUCT_NAME, PROCESS_FUNC)[ID].stream = (STREAM),
+
 #define MSG_OUT(ID, STRUCT_NAME, PROCESS_FUNC)                        \
   [ID].msg_id = (ID), [ID].type = (NORMAL_MSG), [ID].dir = (OUT_MSG), \
   [ID].fields = (STRUCT_NAME##_fields), [ID].dispatch = (PARSABLE),   \
@@ -76,9 +81,25 @@ typedef enum { IN_MSG, OUT_MSG } MessageMapDirection;
 
 typedef enum { PARSABLE, RAW } MessageMapDispatch;
 
+/// Consumer for one top-level bytes field that is delivered piecewise while
+/// the message is still being received, rather than through the decoded
+/// struct. The remaining fields are decoded and dispatched as usual.
+typedef struct {
+  /// Field number of the streamed bytes field.
+  uint32_t tag;
+  /// Called on the first frame of every message using this stream.
+  void (*begin)(void);
+  /// Called with each piece of the field, in order. \p total is the full
+  /// length of the field. Return false to reject the message.
+  bool (*data)(const uint8_t* buf, size_t len, uint32_t total);
+  /// Called when a message that has started streaming is not dispatched.
+  void (*abort)(void);
+} MessageStream;
+
 typedef struct {
   const pb_field_t* fields;
   msg_handler_t process_func;
+  const MessageStream* stream;
   MessageMapDispatch dispatch;
   MessageMapType type;
   MessageMapDirection dir;
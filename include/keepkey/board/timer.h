@@ -75,4 +75,9 @@ void post_periodic(Runnable runnable, void* context, uint32_t period_ms,
 void remove_runnable(Runnable runnable);
 void clear_runnables(void);
 
+#ifdef EMULATOR
+void timer_advance_ms(uint32_t ms);
+uint32_t timer_next_deadline_ms(void);
+#endif
+
 #endif
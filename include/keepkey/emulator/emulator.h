@@ -25,8 +25,22 @@
 void emulatorPoll(void);
 void emulatorRandom(void* buffer, size_t size);
 
+/// Bind the main and debug interfaces to UDP ports KEEPKEY_UDP_PORT and
+/// KEEPKEY_UDP_PORT + 1, or $KEEPKEY_UDP_PORT and the one after it. If the
+/// variable is 0, each interface gets a free port from the kernel instead.
 void emulatorSocketInit(void);
+
+/// \returns the UDP port interface \p iface is bound to, or 0 if it has
+///          none.
+int emulatorSocketPort(int iface);
 size_t emulatorSocketRead(int* iface, void* buffer, size_t size);
 size_t emulatorSocketWrite(int iface, const void* buffer, size_t size);
 
+/// Send any reports queued by emulatorSocketWrite().
+void emulatorSocketFlush(void);
+
+/// Flush output, then block until input is available or \p timeout_ms
+/// passes. \returns nonzero if emulatorSocketRead() has input.
+int emulatorSocketWait(int timeout_ms);
+
 #endif
@@ -3,7 +3,27 @@
  *
  * The host process provides a pre-allocated 1MB flash buffer.
  * All I/O goes through ring buffers (no UDP sockets).
- * Single-threaded: call kkemu_poll() from your event loop.
+ *
+ * Each emulated device is a kkemu_ctx handle from kkemu_create(), with its
+ * own flash buffer, rings, display capture and firmware state (storage,
+ * session, FSM, canvas, timers). A host may keep several devices open at
+ * once, for instance one per wallet, and drive each from its own thread.
+ * The firmware itself is not reentrant, so calls that run firmware code
+ * (create, destroy, poll, get_display, the dirty range calls) take a
+ * process-wide lock: devices take turns, they don't run in parallel.
+ *
+ * kkemu_ctx_write()/kkemu_ctx_write_many()/kkemu_ctx_send_message() may be
+ * called from a host thread other than the one driving kkemu_ctx_poll() on
+ * that handle (the rings are single-producer/single-consumer), and likewise
+ * for the read side; all other calls on a handle must come from its polling
+ * thread.
+ *
+ * The library must be loaded as a shared library: a handle's firmware state
+ * is the library's writable data, which is copied in and out as handles
+ * take turns.
+ *
+ * kkemu_init() and the calls without a handle argument are a single-device
+ * API on top of one implicit handle, for hosts that only ever need one.
  */
 #ifndef LIBKKEMU_H
 #define LIBKKEMU_H
@@ -20,6 +40,22 @@ extern "C" {
 #define KKEMU_IFACE_MAIN 0
 #define KKEMU_IFACE_DEBUG 1
 
+/**
+ * Largest payload kkemu_send_message() and kkemu_recv_message() carry: a
+ * frame of that size takes 126 reports, which leaves a slot to spare in a
+ * queue of 127.
+ */
+#define KKEMU_MESSAGE_MAX (55 + 125 * 63)
+
+/** A span of the flash buffer, as a byte offset from flash_buf. */
+typedef struct {
+  uint32_t offset;
+  uint32_t len;
+} kkemu_flash_range;
+
+/** Called after the firmware wrote to the flash buffer. */
+typedef void (*kkemu_commit_cb)(void* user);
+
 /**
  * Initialize the emulator with a host-provided flash buffer.
  *
@@ -28,7 +64,8 @@ extern "C" {
  *                   If contents are from a previous session, device state is
  * restored.
  * @param flash_len  Must be KKEMU_FLASH_SIZE (1048576).
- * @return 0 on success, -1 on error.
+ * @return 0 on success, -1 on bad arguments or if the emulator is already
+ *         running. kkemu_create() starts further devices alongside it.
  *
  * After this call, the emulator is ready to process messages via
  * kkemu_write() + kkemu_poll() + kkemu_read().
@@ -37,8 +74,11 @@ int kkemu_init(uint8_t* flash_buf, size_t flash_len);
 
 /**
  * Shut down the emulator. Flushes pending storage writes to the
- * flash buffer. After this call, the host should encrypt and persist
- * the flash buffer, then zero it.
+ * flash buffer, clears session secrets and zeroes the library's rings and
+ * display capture. Does nothing if the emulator is not running. After
+ * this call, the host should encrypt and persist the flash buffer, then
+ * zero it. A host that keeps the rest of the previous image can persist
+ * just kkemu_get_dirty_ranges() instead.
  */
 void kkemu_shutdown(void);
 
@@ -64,6 +104,74 @@ int kkemu_write(const uint8_t* data, size_t len, int iface);
  */
 int kkemu_read(uint8_t* buf, size_t len, int iface);
 
+/**
+ * Write up to `count` 64-byte HID reports into the input queue in one call.
+ *
+ * @param data   count * 64 contiguous bytes.
+ * @param count  Number of reports.
+ * @param iface  KKEMU_IFACE_MAIN (0) or KKEMU_IFACE_DEBUG (1).
+ * @return Number of reports queued (less than count if the queue filled
+ *         up), or -1 on error.
+ */
+int kkemu_write_many(const uint8_t* data, size_t count, int iface);
+
+/**
+ * Read up to `max_count` 64-byte HID reports from the output queue.
+ *
+ * Non-blocking.
+ *
+ * @param buf        Buffer of at least max_count * 64 bytes.
+ * @param max_count  Maximum number of reports to read.
+ * @param iface      KKEMU_IFACE_MAIN (0) or KKEMU_IFACE_DEBUG (1).
+ * @return Number of reports read (0 if the queue is empty), or -1 on error.
+ */
+int kkemu_read_many(uint8_t* buf, size_t max_count, int iface);
+
+/**
+ * Frame a protobuf message ('?##' + id + length) and queue all of its
+ * reports at once.
+ *
+ * @param iface    KKEMU_IFACE_MAIN (0) or KKEMU_IFACE_DEBUG (1).
+ * @param msg_id   MessageType of the payload.
+ * @param payload  Encoded protobuf bytes.
+ * @param len      Payload length, at most KKEMU_MESSAGE_MAX.
+ * @return 0 on success, -1 if the message is larger than KKEMU_MESSAGE_MAX
+ *         or doesn't fit in the input queue right now (nothing is queued
+ *         in that case).
+ */
+int kkemu_send_message(int iface, uint16_t msg_id, const uint8_t* payload,
+                       size_t len);
+
+/**
+ * Dequeue one complete message from the output queue, stripping the
+ * '?##' framing.
+ *
+ * Non-blocking. A message is only dequeued once all of its reports have
+ * been produced.
+ *
+ * The firmware never leaves a partial message in the queue. A message
+ * larger than KKEMU_MESSAGE_MAX, or one sent while the queue was full, is
+ * replaced by a lone frame header, reported here as -2. If several are
+ * lost in a row, only the first one may be reported. A frame the host
+ * began reading with kkemu_read()/kkemu_read_many() is skipped.
+ *
+ * @param iface    KKEMU_IFACE_MAIN (0) or KKEMU_IFACE_DEBUG (1).
+ * @param msg_id   Receives the MessageType once the frame header is
+ *                 available.
+ * @param buf      Receives the encoded protobuf payload.
+ * @param buf_len  Size of buf.
+ * @param msg_len  Receives the payload length once the frame header is
+ *                 available: on the -1 path the size to retry with; on the
+ *                 -2 path the size of a message that was too large, or
+ *                 UINT32_MAX if the queue was full.
+ * @return 1 if a message was dequeued, 0 if no complete message is
+ *         available yet, -1 if buf is too small (the message stays queued;
+ *         retry with *msg_len bytes), or -2 if the firmware's next message
+ *         was lost (the report standing in for it is dequeued).
+ */
+int kkemu_recv_message(int iface, uint16_t* msg_id, uint8_t* buf,
+                       size_t buf_len, size_t* msg_len);
+
 /**
  * Run one iteration of the firmware event loop.
  *
@@ -76,6 +184,28 @@ int kkemu_read(uint8_t* buf, size_t len, int iface);
  */
 int kkemu_poll(void);
 
+/**
+ * Event-driven alternative to kkemu_poll().
+ *
+ * Sleeps until a report is written with kkemu_write() (from any thread),
+ * the next firmware timer is due, or timeout_ms elapses, whichever is
+ * first. Then it dispatches every queued input report, updates animations
+ * and refreshes the display. The firmware's 1 ms timer is advanced by the
+ * host time elapsed since the previous call, so runnables fire on time.
+ *
+ * Call it in a loop instead of polling at a fixed rate. Per-message latency
+ * is then bounded by firmware work, not by the poll interval.
+ *
+ * @param timeout_ms        Maximum time to sleep; 0 never sleeps, negative
+ *                          sleeps until input or a timer is due.
+ * @param next_deadline_ms  Optional. Receives the number of milliseconds
+ *                          until the next firmware timer is due, or -1 if
+ *                          none is scheduled (fully idle).
+ * @return 1 if input was dispatched, 0 if the call only idled/ran timers,
+ *         or -1 if the emulator is not initialized.
+ */
+int kkemu_poll_wait(int timeout_ms, int* next_deadline_ms);
+
 /**
  * Get the OLED framebuffer (256x64, 1-bit per pixel = 2048 bytes).
  *
@@ -99,7 +229,7 @@ const uint8_t* kkemu_get_display(int* width, int* height);
  *
  * Every display_refresh() inside the firmware (including those that fire
  * inside confirm_helper's busy loop within a single kkemu_poll() call)
- * snapshots the canvas into a ring buffer. Adjacent identical frames
+ * that changes the screen queues a frame. Adjacent identical frames
  * are deduplicated. This lets the host see intermediate screen states
  * (confirm dialogs, cipher prompts, recovery screens) that would
  * otherwise be invisible — they exist only inside synchronous C calls.
@@ -110,11 +240,200 @@ const uint8_t* kkemu_get_display(int* width, int* height);
  */
 int kkemu_pop_frame(uint8_t* out_packed);
 
+/** Frame stream record holding a whole packed frame. */
+#define KKEMU_FRAME_KEY 0
+/** Frame stream record holding the XOR with the previous frame. */
+#define KKEMU_FRAME_DELTA 1
+/** Largest encoded frame stream record (2048 literals + count bytes). */
+#define KKEMU_FRAME_RLE_MAX (2048 + 2048 / 128)
+
+/**
+ * Pop the next captured frame as an encoded frame stream record, without
+ * decoding it. This is the cheap way to record a session: static screens
+ * encode to a few dozen bytes.
+ *
+ * Records are run-length encoded: a positive int8 count n is followed by
+ * one byte repeated n times, a negative count -n by n literal bytes. They
+ * decode to 2048 bytes, which are either the packed frame itself
+ * (KKEMU_FRAME_KEY) or its XOR with the previous frame (KKEMU_FRAME_DELTA).
+ * A keyframe is queued at least every 32 frames and always right after
+ * frames were dropped. kkemu_frame_apply() decodes a record.
+ *
+ * Each delta applies to the frame decoded from the record before it, so
+ * apply every record in the order popped. This shares its queue with
+ * kkemu_pop_frame(), and both calls keep that function's decoded frame up
+ * to date, so they may be mixed.
+ *
+ * @param out      Receives the record (KKEMU_FRAME_RLE_MAX bytes always
+ *                 suffice).
+ * @param out_len  Size of out.
+ * @param kind     Receives KKEMU_FRAME_KEY or KKEMU_FRAME_DELTA.
+ * @return Record length, 0 if no frame is queued, or -1 if out_len is too
+ *         small (the record stays queued).
+ */
+int kkemu_pop_frame_rle(uint8_t* out, size_t out_len, int* kind);
+
+/**
+ * Apply a frame stream record to a 2048-byte packed frame. For deltas,
+ * frame must hold the frame decoded from the previous record.
+ *
+ * @return 0 on success, -1 if the record is malformed.
+ */
+int kkemu_frame_apply(uint8_t* frame, const uint8_t* rec, size_t len,
+                      int kind);
+
+/**
+ * Number of captured frames discarded so far because the host did not
+ * drain the frame stream fast enough, since kkemu_init().
+ */
+uint32_t kkemu_frames_dropped(void);
+
+/**
+ * List the parts of the flash buffer written since kkemu_init() or the last
+ * kkemu_clear_dirty(), at flash sector granularity (16 KB for the storage
+ * sectors). Adjacent sectors are merged into one range.
+ *
+ * Still valid after kkemu_shutdown(), so the final storage flush is
+ * included.
+ *
+ * @param ranges      Receives up to max_ranges ranges, in address order.
+ * @param max_ranges  Size of ranges.
+ * @return Total number of dirty ranges (may exceed max_ranges), or -1 on
+ *         error.
+ */
+int kkemu_get_dirty_ranges(kkemu_flash_range* ranges, size_t max_ranges);
+
+/**
+ * Forget the dirty ranges, typically once the host has persisted them.
+ */
+void kkemu_clear_dirty(void);
+
+/**
+ * Register a callback run at the end of any kkemu_poll()/kkemu_poll_wait()
+ * that wrote to the flash buffer, and once more from kkemu_shutdown() if
+ * its final flush did. It runs on the polling thread; call
+ * kkemu_get_dirty_ranges() from it to find what changed.
+ *
+ * @param cb    Callback, or NULL to remove it.
+ * @param user  Passed to cb.
+ */
+void kkemu_set_commit_callback(kkemu_commit_cb cb, void* user);
+
+/**
+ * Negotiate how EthereumSignTx data is transferred. By default each
+ * EthereumTxRequest asks for up to 1024 bytes and the host answers with one
+ * EthereumTxAck, as over USB.
+ *
+ * @param chunk_size  Most data bytes the host wants to send per
+ *                    EthereumTxAck.
+ * @param stream      Nonzero to stream: the device asks for the first data
+ *                    chunk only, and the host then sends every remaining
+ *                    EthereumTxAck without waiting. The next
+ *                    EthereumTxRequest carries the signature. If the device
+ *                    fails a chunk, each TxAck still queued behind it gets a
+ *                    Failure of its own.
+ * @return The chunk size the device will ask for (chunk_size clamped to
+ *         1024..7680 bytes), or 0 if the emulator is not running. Applies
+ *         from the next EthereumSignTx.
+ */
+uint32_t kkemu_set_ethereum_chunking(uint32_t chunk_size, int stream);
+
 /**
  * Check if the emulator has been initialized.
  */
 int kkemu_is_running(void);
 
+/* ── Handle API ─────────────────────────────────────────────────────── */
+
+/** An emulated device. */
+typedef struct kkemu_ctx kkemu_ctx;
+
+/**
+ * Start an emulated device on a host-provided flash buffer, as
+ * kkemu_init() does. Any number of devices may be open at once, but each
+ * needs a flash buffer of its own.
+ *
+ * @return The new device, or NULL on bad arguments or if out of memory.
+ */
+kkemu_ctx* kkemu_create(uint8_t* flash_buf, size_t flash_len);
+
+/**
+ * Shut a device down as kkemu_shutdown() does, and free the handle. The
+ * commit callback may run once more from here; it may only call
+ * kkemu_ctx_get_dirty_ranges() and kkemu_ctx_clear_dirty() on the handle.
+ * Does nothing for NULL.
+ */
+void kkemu_destroy(kkemu_ctx* ctx);
+
+/** kkemu_write() for ctx. */
+int kkemu_ctx_write(kkemu_ctx* ctx, const uint8_t* data, size_t len,
+                    int iface);
+
+/** kkemu_read() for ctx. */
+int kkemu_ctx_read(kkemu_ctx* ctx, uint8_t* buf, size_t len, int iface);
+
+/** kkemu_write_many() for ctx. */
+int kkemu_ctx_write_many(kkemu_ctx* ctx, const uint8_t* data, size_t count,
+                         int iface);
+
+/** kkemu_read_many() for ctx. */
+int kkemu_ctx_read_many(kkemu_ctx* ctx, uint8_t* buf, size_t max_count,
+                        int iface);
+
+/** kkemu_send_message() for ctx. */
+int kkemu_ctx_send_message(kkemu_ctx* ctx, int iface, uint16_t msg_id,
+                           const uint8_t* payload, size_t len);
+
+/** kkemu_recv_message() for ctx. */
+int kkemu_ctx_recv_message(kkemu_ctx* ctx, int iface, uint16_t* msg_id,
+                           uint8_t* buf, size_t buf_len, size_t* msg_len);
+
+/** kkemu_poll() for ctx. */
+int kkemu_ctx_poll(kkemu_ctx* ctx);
+
+/**
+ * kkemu_poll_wait() for ctx. Other devices run while this one sleeps, and
+ * its firmware timer catches up on the time it spent waiting for them.
+ */
+int kkemu_ctx_poll_wait(kkemu_ctx* ctx, int timeout_ms,
+                        int* next_deadline_ms);
+
+/** kkemu_get_display() for ctx; each device has its own scratch buffer. */
+const uint8_t* kkemu_ctx_get_display(kkemu_ctx* ctx, int* width,
+                                     int* height);
+
+/** kkemu_pop_frame() for ctx. */
+int kkemu_ctx_pop_frame(kkemu_ctx* ctx, uint8_t* out_packed);
+
+/** kkemu_pop_frame_rle() for ctx. */
+int kkemu_ctx_pop_frame_rle(kkemu_ctx* ctx, uint8_t* out, size_t out_len,
+                            int* kind);
+
+/** kkemu_frames_dropped() for ctx, since kkemu_create(). */
+uint32_t kkemu_ctx_frames_dropped(kkemu_ctx* ctx);
+
+/**
+ * kkemu_get_dirty_ranges() for ctx, since kkemu_create() or the last
+ * kkemu_ctx_clear_dirty(). Not available once ctx is destroyed; read the
+ * final flush's ranges from the commit callback instead.
+ */
+int kkemu_ctx_get_dirty_ranges(kkemu_ctx* ctx, kkemu_flash_range* ranges,
+                               size_t max_ranges);
+
+/** kkemu_clear_dirty() for ctx. */
+void kkemu_ctx_clear_dirty(kkemu_ctx* ctx);
+
+/**
+ * kkemu_set_commit_callback() for ctx. The callback runs on ctx's polling
+ * thread, outside the firmware lock.
+ */
+void kkemu_ctx_set_commit_callback(kkemu_ctx* ctx, kkemu_commit_cb cb,
+                                   void* user);
+
+/** kkemu_set_ethereum_chunking() for ctx. */
+uint32_t kkemu_ctx_set_ethereum_chunking(kkemu_ctx* ctx, uint32_t chunk_size,
+                                         int stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "keepkey/board/messages.h"
 #include "trezor/crypto/bip32.h"
 #include "messages-ethereum.pb.h"
 
@@ -33,10 +34,35 @@ typedef struct _EthereumMessageSignature EthereumMessageSignature;
 typedef struct _TokenType TokenType;
 typedef struct _CoinType CoinType;
 
+/// Most data bytes asked for by one EthereumTxRequest. Chunks are hashed as
+/// they are received, so this does not bound the decode buffer.
+#define ETHEREUM_DATA_CHUNK_SIZE 1024
+
+#ifdef EMULATOR
+/// Largest chunk an emulator host may negotiate. An EthereumTxAck carrying
+/// it still fits in one KKEMU_MESSAGE_MAX message.
+#define ETHEREUM_DATA_CHUNK_MAX 7680
+
+/// Negotiate data chunking with a host that links the emulator directly.
+/// The device protocol has no way to do this, so USB hosts always get
+/// ETHEREUM_DATA_CHUNK_SIZE chunks, one EthereumTxRequest each.
+/// \param chunk_size  Most data bytes each EthereumTxRequest may ask for.
+/// \param stream      If set, only the first data chunk is requested; the
+///                    host then sends the others in a row without waiting,
+///                    and the next EthereumTxRequest carries the signature.
+/// eturns the chunk size the device will ask for: chunk_size clamped to
+///          [ETHEREUM_DATA_CHUNK_SIZE, ETHEREUM_DATA_CHUNK_MAX]. Takes
+///          effect from the next EthereumSignTx.
+uint32_t ethereum_setDataChunking(uint32_t chunk_size, bool stream);
+#endif
+
 void ethereum_signing_init(EthereumSignTx* msg, const HDNode* node,
                            bool needs_confirm);
 void ethereum_signing_abort(void);
 void ethereum_signing_txack(EthereumTxAck* tx);
+
+/// Hashes EthereumTxAck.data_chunk while it is being received.
+extern const MessageStream ethereum_txack_stream;
 void format_ethereum_address(const uint8_t* to, char* destination_str,
                              uint32_t destination_str_len);
 bool ethereum_isStandardERC20Transfer(const EthereumSignTx* msg);
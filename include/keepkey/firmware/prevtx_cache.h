@@ -0,0 +1,48 @@
+/*
+ * This file is part of the KeepKey project.
+ *
+ * Copyright (C) 2026 KeepKey LLC
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEEPKEY_FIRMWARE_PREVTX_CACHE_H
+#define KEEPKEY_FIRMWARE_PREVTX_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Output amounts of previous transactions already streamed and verified in
+   this signing session, so inputs spending another output of the same
+   prevtx need not stream it again. */
+#define PREVTX_CACHE_TXIDS 4
+#define PREVTX_CACHE_OUTPUTS 64
+
+/// Forget every cached prevtx.
+void prevtx_cache_init(void);
+
+/// Remember an output of the prevtx being streamed. It only becomes visible
+/// to lookups once prevtx_cache_commit() has verified that prevtx.
+void prevtx_cache_add(uint32_t index, uint64_t amount);
+
+/// The prevtx being streamed hashed to \p txid: make the outputs added since
+/// the last commit visible under it. A txid already cached keeps its slot.
+void prevtx_cache_commit(const uint8_t txid[32]);
+
+/// \returns true iff the amount of output \p index of the verified previous
+/// transaction \p txid is known.
+bool prevtx_cache_lookup(const uint8_t txid[32], uint32_t index,
+                         uint64_t* amount);
+
+#endif
@@ -25,8 +25,13 @@
 #include "keepkey/board/memory.h"
 #include "keepkey/firmware/authenticator.h"
 
+/* v18 added the commit log and the U2F counter area after the v17 image.
+   Firmware older than v18 sees an unknown version and wipes the device, so
+   downgrading past it needs the recovery sentence. The bootloader only
+   matches STORAGE_MAGIC_STR and keeps the sectors across updates either
+   way. */
 #define STORAGE_VERSION \
-  17 /* Must add case fallthrough in storage_fromFlash after increment*/
+  18 /* Must add case fallthrough in storage_fromFlash after increment*/
 #define STORAGE_RETRIES 3
 
 #define RANDOM_SALT_LEN 32
@@ -59,6 +64,16 @@ void session_clear(bool clear_pin);
 ///        in flash.
 void storage_commit(void);
 
+/// \brief Note a change to shadow memory that can wait for storage_flush().
+///        Use storage_commit() for anything that must survive a reset right
+///        away, like PINs, seeds, counters, policies and passphrase
+///        protection.
+void storage_commitDeferred(void);
+
+/// \brief Commit changes noted by storage_commitDeferred(), if any. Called
+///        once each message has been handled.
+void storage_flush(void);
+
 /// \brief Load configuration data from usb message to shadow memory
 typedef struct _LoadDevice LoadDevice;
 void storage_loadDevice(LoadDevice* msg);
@@ -70,6 +85,14 @@ void storage_loadDevice(LoadDevice* msg);
 /// \return true iff the root node was found.
 bool storage_getRootNode(const char* curve, bool usePassphrase, HDNode* node);
 
+/// \brief Derive a child of the root node, reusing parent nodes derived
+///        earlier in this session. Drop-in for hdnode_private_ckd_cached().
+/// \param inout[in,out]  The root node on input, the derived node on output.
+/// \param fingerprint[out]  Fingerprint of the derived node's parent.
+/// \return nonzero iff derivation succeeded.
+int session_deriveNode(HDNode* inout, const uint32_t* address_n,
+                       size_t address_n_count, uint32_t* fingerprint);
+
 /// \brief Fetch the node used for U2F signing.
 /// \returns true iff retrieval was successful.
 bool storage_getU2FRoot(HDNode* node);
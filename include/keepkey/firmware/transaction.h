@@ -29,6 +29,9 @@
 
 #define TX_OVERWINTERED 0x80000000
 
+/* Largest run of serialized outputs signing keeps for legacy inputs */
+#define TX_OUTPUTS_CACHE_SIZE 2048
+
 /* Transaction output compilation errors */
 #define TXOUT_OK 1
 #define TXOUT_COMPILE_ERROR 0
@@ -100,6 +103,10 @@ void tx_init(TxStruct* tx, uint32_t inputs_len, uint32_t outputs_len,
 uint32_t tx_serialize_header_hash(TxStruct* tx);
 uint32_t tx_serialize_input_hash(TxStruct* tx, const TxInputType* input);
 uint32_t tx_serialize_output_hash(TxStruct* tx, const TxOutputBinType* output);
+uint32_t tx_serialize_output_raw(const TxOutputBinType* output, uint8_t* out,
+                                 uint32_t out_len);
+uint32_t tx_serialize_outputs_raw_hash(TxStruct* tx, const uint8_t* data,
+                                      uint32_t datalen);
 uint32_t tx_serialize_extra_data_hash(TxStruct* tx, const uint8_t* data,
                                       uint32_t datalen);
 uint32_t tx_serialize_decred_witness_hash(TxStruct* tx,
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the KeepKey project.
+ *
+ * Copyright (C) 2015 KeepKey LLC
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keepkey/board/canvas.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#pragma GCC push_options
+#pragma GCC optimize("-O3")
+
+/*
+ * canvas_pack_page() - Pack one 8-row page of columns [x0, x1)
+ *
+ * INPUT
+ *     - rows: first canvas row of the page
+ *     - stride: canvas width
+ *     - x0, x1: column range
+ *     - out: packed page, indexed by column
+ * OUTPUT
+ *     none
+ */
+static void canvas_pack_page(const uint8_t* rows, uint16_t stride, uint16_t x0,
+                             uint16_t x1, uint8_t* out) {
+  uint16_t x = x0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= x1; x += 16) {
+    __m128i acc = zero;
+    for (int y = 0; y < 8; y++) {
+      __m128i px = _mm_loadu_si128((const __m128i*)&rows[y * stride + x]);
+      __m128i off = _mm_cmpeq_epi8(px, zero);
+      acc = _mm_or_si128(acc, _mm_andnot_si128(off, _mm_set1_epi8(1 << y)));
+    }
+    _mm_storeu_si128((__m128i*)&out[x], acc);
+  }
+#elif defined(__ARM_NEON)
+  for (; x + 16 <= x1; x += 16) {
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (int y = 0; y < 8; y++) {
+      uint8x16_t px = vld1q_u8(&rows[y * stride + x]);
+      acc = vorrq_u8(acc, vandq_u8(vtstq_u8(px, px), vdupq_n_u8(1 << y)));
+    }
+    vst1q_u8(&out[x], acc);
+  }
+#endif
+
+  for (; x < x1; x++) {
+    uint8_t b = 0;
+    for (int y = 0; y < 8; y++) {
+      b |= (uint8_t)((rows[y * stride + x] != 0) << y);
+    }
+    out[x] = b;
+  }
+}
+
+/*
+ * canvas_pack_mono() - Pack part of an 8-bpp canvas into 1-bpp pages
+ *
+ * INPUT
+ *     - buf: canvas pixels, one byte per pixel
+ *     - width: canvas width
+ *     - x0, x1: column range
+ *     - page0, page1: range of 8-row pages
+ *     - out: packed image, byte index = x + page * width, bit = y % 8
+ * OUTPUT
+ *     none
+ */
+void canvas_pack_mono(const uint8_t* buf, uint16_t width, uint16_t x0,
+                      uint16_t x1, uint16_t page0, uint16_t page1,
+                      uint8_t* out) {
+  for (uint16_t p = page0; p < page1; p++) {
+    canvas_pack_page(&buf[p * 8 * width], width, x0, x1, &out[p * width]);
+  }
+}
+
+#pragma GCC pop_options
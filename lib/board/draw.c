@@ -61,6 +61,8 @@ bool draw_char_with_shift(Canvas* canvas, DrawableParams* p, uint16_t* x_shift,
         ((img->height + p->y) <= canvas->height)) {
       const uint8_t* img_pixel = &img->data[0];
 
+      canvas_mark_dirty(canvas, p->x, p->y, img->width, img->height);
+
       int y;
 
       for (y = 0; y < img->height; y++) {
@@ -244,6 +246,8 @@ void draw_box(Canvas* canvas, BoxDrawableParams* p) {
   uint16_t height = end_row - start_row;
   uint16_t width = end_col - start_col;
 
+  canvas_mark_dirty(canvas, start_col, start_row, width, height);
+
   for (uint16_t y = 0; y < height; y++) {
     for (uint16_t x = 0; x < width; x++) {
       if (canvas_pixel >= canvas_end) {
@@ -255,8 +259,6 @@ void draw_box(Canvas* canvas, BoxDrawableParams* p) {
 
     canvas_pixel += (canvas->width - width);
   }
-
-  canvas->dirty = true;
 }
 
 /*
@@ -302,6 +304,8 @@ bool draw_bitmap_mono_rle(Canvas* canvas, const AnimationFrame* frame,
     return false;
   }
 
+  canvas_mark_dirty(canvas, frame->x, frame->y, img->w, img->h);
+
   int8_t sequence = 0;
   int8_t nonsequence = 0;
   uint32_t pixel_index = 0;
@@ -346,7 +350,6 @@ bool draw_bitmap_mono_rle(Canvas* canvas, const AnimationFrame* frame,
     }
   }
 
-  canvas->dirty = true;
   return true;
 }
 #pragma GCC pop_options
@@ -33,7 +33,9 @@
 #include "keepkey/rand/rng.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Stack smashing protector (SSP) canary value storage */
 uintptr_t __stack_chk_guard;
@@ -112,21 +114,38 @@ void kk_board_init(void) {
 }
 
 #ifdef EMULATOR
-/// Reverses (reflects) bits in a 32-bit word.
-/// http://www.hackersdelight.org/hdcodetxt/crc.c.txt
-static uint32_t reverse(unsigned x) {
-  x = ((x & 0x55555555) << 1) | ((x >> 1) & 0x55555555);
-  x = ((x & 0x33333333) << 2) | ((x >> 2) & 0x33333333);
-  x = ((x & 0x0F0F0F0F) << 4) | ((x >> 4) & 0x0F0F0F0F);
-  x = (x << 24) | ((x & 0xFF00) << 8) | ((x >> 8) & 0xFF00) | (x >> 24);
-  return x;
+/* Slice-by-8 tables for the STM32 CRC unit: polynomial 0x04C11DB7, MSB
+ * first, no reflection and no final xor. crc_tables[0] is the plain
+ * byte-at-a-time table, crc_tables[k] advances it by k more zero bytes. */
+static uint32_t crc_tables[8][256];
+static bool crc_tables_ready = false;
+
+static void crc_init_tables(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i << 24;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+    crc_tables[0][i] = crc;
+  }
+
+  for (int k = 1; k < 8; k++) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t prev = crc_tables[k - 1][i];
+      crc_tables[k][i] = (prev << 8) ^ crc_tables[0][prev >> 24];
+    }
+  }
+
+  crc_tables_ready = true;
 }
 #endif
 
-/* calc_crc32() - Calculate crc32 for block of memory
+/* calc_crc32() - Calculate crc32 for block of memory, the way the STM32 CRC
+ * unit does: one 32-bit word at a time, as loaded from memory
  *
  * INPUT
- *     none
+ *     - data: word aligned data
+ *     - word_len: number of 32-bit words
  * OUTPUT
  *     crc32 of data
  */
@@ -137,20 +156,32 @@ uint32_t calc_crc32(const void* data, int word_len) {
   crc_reset();
   crc32 = crc_calculate_block((uint32_t*)data, word_len);
 #else
-  /// http://www.hackersdelight.org/hdcodetxt/crc.c.txt
+  if (!crc_tables_ready) {
+    crc_init_tables();
+  }
+
+  const uint8_t* p = (const uint8_t*)data;
   crc32 = 0xFFFFFFFF;
-  for (int i = 0; i < word_len; i++) {
-    uint32_t byte = ((const char*)data)[i];  // Get next byte.
-    byte = reverse(byte);                    // 32-bit reversal.
-    for (int j = 0; j <= 7; j++) {           // Do eight times.
-      if ((int)(crc32 ^ byte) < 0)
-        crc32 = (crc32 << 1) ^ 0x04C11DB7;
-      else
-        crc32 = crc32 << 1;
-      byte = byte << 1;  // Ready next msg bit.
-    }
+
+  int i = 0;
+  for (; i + 1 < word_len; i += 2, p += 8) {
+    uint32_t w0, w1;
+    memcpy(&w0, p, sizeof(w0));
+    memcpy(&w1, p + 4, sizeof(w1));
+    crc32 ^= w0;
+    crc32 = crc_tables[7][crc32 >> 24] ^ crc_tables[6][(crc32 >> 16) & 0xff] ^
+            crc_tables[5][(crc32 >> 8) & 0xff] ^ crc_tables[4][crc32 & 0xff] ^
+            crc_tables[3][w1 >> 24] ^ crc_tables[2][(w1 >> 16) & 0xff] ^
+            crc_tables[1][(w1 >> 8) & 0xff] ^ crc_tables[0][w1 & 0xff];
+  }
+
+  if (i < word_len) {
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    crc32 ^= w;
+    crc32 = crc_tables[3][crc32 >> 24] ^ crc_tables[2][(crc32 >> 16) & 0xff] ^
+            crc_tables[1][(crc32 >> 8) & 0xff] ^ crc_tables[0][crc32 & 0xff];
   }
-  crc32 = reverse(~crc32);
 #endif
 
   return crc32;
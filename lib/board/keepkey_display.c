@@ -27,6 +27,8 @@
 #include "keepkey/board/timer.h"
 #include "keepkey/board/supervise.h"
 
+#include <string.h>
+
 #pragma GCC push_options
 #pragma GCC optimize("-O3")
 
@@ -266,6 +268,7 @@ Canvas* display_canvas_init(void) {
   canvas.width = KEEPKEY_DISPLAY_WIDTH;
   canvas.height = KEEPKEY_DISPLAY_HEIGHT;
   canvas.dirty = false;
+  memset(&canvas.dirty_rect, 0, sizeof(canvas.dirty_rect));
 
   return &canvas;
 }
@@ -280,9 +283,29 @@ Canvas* display_canvas_init(void) {
  */
 Canvas* display_canvas(void) { return &canvas; }
 
-void (*DumpDisplay)(const uint8_t* buf) = 0;
+DumpDisplayCallback DumpDisplay = 0;
 void display_set_dump_callback(DumpDisplayCallback d) { DumpDisplay = d; }
 
+/*
+ * display_set_window() - Restrict GRAM writes to a window of the panel
+ *
+ * INPUT
+ *     - x0, x1: first / one past last pixel column, multiples of 4
+ *     - y0, y1: first / one past last pixel row
+ * OUTPUT
+ *     none
+ */
+static void display_set_window(uint16_t x0, uint16_t y0, uint16_t x1,
+                               uint16_t y1) {
+  /* Columns are in units of 4 pixels (2 bytes at 4 bits/pixel) */
+  display_write_reg((uint8_t)0x15);
+  display_write_ram((uint8_t)(START_COL + x0 / 4));
+  display_write_ram((uint8_t)(START_COL + x1 / 4 - 1));
+  display_write_reg((uint8_t)0x75);
+  display_write_ram((uint8_t)(START_ROW + y0));
+  display_write_ram((uint8_t)(START_ROW + y1 - 1));
+}
+
 /*
  * display_refresh() - Refresh display
  *
@@ -292,39 +315,61 @@ void display_set_dump_callback(DumpDisplayCallback d) { DumpDisplay = d; }
  *     none
  */
 void display_refresh(void) {
+  if (canvas.dirty && constant_power) {
+    for (int y = 0; y < 64; y++) {
+      for (int x = 0; x < 128; x++) {
+        canvas.buffer[y * 256 + x] = 255 - canvas.buffer[y * 256 + x + 128];
+      }
+    }
+    canvas_mark_dirty(&canvas, 0, 0, canvas.width, canvas.height);
+  }
+
   if (DumpDisplay) {
-    DumpDisplay(canvas.buffer);
+    DumpDisplay(canvas.buffer, &canvas.dirty_rect);
   }
 
   if (!canvas.dirty) {
     return;
   }
 
-  if (constant_power) {
-    for (int y = 0; y < 64; y++) {
-      for (int x = 0; x < 128; x++) {
-        canvas.buffer[y * 256 + x] = 255 - canvas.buffer[y * 256 + x + 128];
-      }
-    }
+#ifdef INVERT_DISPLAY
+  /* The window below is not mirrored, so always rewrite the whole panel */
+  canvas_mark_dirty(&canvas, 0, 0, canvas.width, canvas.height);
+#endif
+
+  CanvasRect* r = &canvas.dirty_rect;
+  if (!r->width || !r->height) {
+    canvas.dirty = false;
+    return;
   }
 
-  display_prepare_gram_write();
+  /* Only rewrite the columns and rows that were drawn to */
+  uint16_t x0 = r->x & ~3;
+  uint16_t x1 = (r->x + r->width + 3) & ~3;
+  uint16_t y0 = r->y;
+  uint16_t y1 = r->y + r->height;
 
-  int num_writes = canvas.width * canvas.height;
+  display_set_window(x0, y0, x1, y1);
+  display_prepare_gram_write();
 
-  int i;
 #ifdef INVERT_DISPLAY
+  int num_writes = canvas.width * canvas.height;
 
-  for (i = num_writes; i > 0; i -= 2) {
+  for (int i = num_writes; i > 0; i -= 2) {
     uint8_t v = (0xF0 & canvas.buffer[i]) | (canvas.buffer[i - 1] >> 4);
-#else
-
-  for (i = 0; i < num_writes; i += 2) {
-    uint8_t v = (0xF0 & canvas.buffer[i]) | (canvas.buffer[i + 1] >> 4);
-#endif
     display_write_ram(v);
   }
+#else
+  for (uint16_t y = y0; y < y1; y++) {
+    const uint8_t* row = &canvas.buffer[y * canvas.width];
+    for (uint16_t x = x0; x < x1; x += 2) {
+      uint8_t v = (0xF0 & row[x]) | (row[x + 1] >> 4);
+      display_write_ram(v);
+    }
+  }
+#endif
 
+  memset(r, 0, sizeof(*r));
   canvas.dirty = false;
 }
 
@@ -40,6 +40,66 @@
 
 uint8_t HW_ENTROPY_DATA[HW_ENTROPY_LEN];
 
+#ifdef EMULATOR
+/* Sectors erased or written since the last flash_clearDirty(), as a bitmap
+ * of sector numbers. */
+static uint32_t flash_dirty = 0;
+
+/*
+ * flash_markDirty() - Note the sectors overlapping a write
+ *
+ * INPUT
+ *     - group: functional group written to
+ *     - offset: offset of the write within the group
+ *     - len: length of the write
+ * OUTPUT
+ *     none
+ */
+static void flash_markDirty(Allocation group, uint32_t offset, uint32_t len) {
+  const FlashSector* s = flash_sector_map;
+  while (s->use != FLASH_INVALID && s->use != group) {
+    ++s;
+  }
+  if (s->use == FLASH_INVALID || len == 0) return;
+
+  size_t start = s->start + offset, end = start + len;
+  for (s = flash_sector_map; s->use != FLASH_INVALID; ++s) {
+    if (start < s->start + s->len && s->start < end) {
+      flash_dirty |= 1u << s->sector;
+    }
+  }
+}
+
+uint32_t flash_getDirty(void) { return flash_dirty; }
+
+void flash_clearDirty(void) { flash_dirty = 0; }
+
+size_t flash_dirtyRanges(uint32_t dirty, FlashRange* ranges,
+                         size_t max_ranges) {
+  /* flash_sector_map is in address order, so adjacent sectors merge */
+  size_t count = 0;
+  uint32_t end = 0;
+  for (const FlashSector* s = flash_sector_map; s->use != FLASH_INVALID;
+       ++s) {
+    if (!(dirty & (1u << s->sector))) continue;
+
+    uint32_t start = (uint32_t)(s->start - FLASH_ORIGIN);
+    if (count && start == end) {
+      if (count <= max_ranges) ranges[count - 1].len += s->len;
+    } else {
+      count++;
+      if (count <= max_ranges) {
+        ranges[count - 1].offset = start;
+        ranges[count - 1].len = s->len;
+      }
+    }
+    end = start + s->len;
+  }
+
+  return count;
+}
+#endif
+
 /*
  * flash_write_helper() - Helper function to locate starting address of
  * the functional group
@@ -96,15 +156,19 @@ bool flash_chk_status(void) {
  *     none
  */
 void flash_erase_word(Allocation group) {
-#ifndef EMULATOR
   const FlashSector* s = flash_sector_map;
   while (s->use != FLASH_INVALID) {
     if (s->use == group) {
+#ifndef EMULATOR
       svc_flash_erase_sector((uint32_t)s->sector);
+#else
+      // Storage relies on erased flash reading back as 0xff.
+      memset((void*)FLASH_PTR(s->start), 0xff, s->len);
+      flash_dirty |= 1u << s->sector;
+#endif
     }
     ++s;
   }
-#endif
 }
 
 /*
@@ -163,6 +227,7 @@ fww_exit:
   return (retval);
 #else
   memcpy((void*)(flash_write_helper(group) + offset), data, len);
+  flash_markDirty(group, offset, len);
   return true;
 #endif
 }
@@ -189,6 +254,7 @@ bool flash_write(Allocation group, uint32_t offset, uint32_t len,
   return (retval);
 #else
   memcpy((void*)(flash_write_helper(group) + offset), data, len);
+  flash_markDirty(group, offset, len);
   return true;
 #endif
 }
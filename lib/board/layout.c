@@ -204,6 +204,11 @@ static Animation* animation_queue_get(AnimationQueue* queue,
 void layout_init(Canvas* new_canvas) {
   canvas = new_canvas;
 
+  active_queue.head = NULL;
+  active_queue.size = 0;
+  free_queue.head = NULL;
+  free_queue.size = 0;
+
   int i;
 
   for (i = 0; i < MAX_ANIMATIONS; i++) {
@@ -682,6 +687,7 @@ void layout_clear_static(void) {
   display_constant_power(false);
 
   memset(canvas->buffer, 0, canvas->width * canvas->height);
+  canvas_mark_dirty(canvas, 0, 0, canvas->width, canvas->height);
 }
 
 /*
@@ -25,6 +25,7 @@
 #include "keepkey/board/util.h"
 
 #include <nanopb.h>
+#include <pb_common.h>
 
 #include <assert.h>
 #include <string.h>
@@ -107,6 +108,43 @@ static bool pb_parse(const MessagesMap_t* entry, const uint8_t* msg,
   return pb_decode(&stream, entry->fields, buf);
 }
 
+/*
+ * pb_struct_extent() - Number of bytes of a decoded struct covered by its
+ * fields, including every element of static repeated fields
+ *
+ * INPUT
+ *     - fields: protocol buffer field descriptors
+ *     - dest: base of the struct
+ * OUTPUT
+ *     extent in bytes
+ */
+static size_t pb_struct_extent(const pb_field_t* fields, void* dest) {
+  pb_field_iter_t iter;
+  size_t extent = 0;
+
+  if (!pb_field_iter_begin(&iter, fields, dest)) {
+    return 0;
+  }
+
+  do {
+    size_t size = iter.pos->data_size;
+    if (PB_ATYPE(iter.pos->type) == PB_ATYPE_STATIC &&
+        PB_HTYPE(iter.pos->type) == PB_HTYPE_REPEATED) {
+      size *= iter.pos->array_size;
+    }
+
+    size_t end = (size_t)((uint8_t*)iter.pData - (uint8_t*)dest) + size;
+    extent = MAX(extent, end);
+
+    if (iter.pSize != iter.pData) {
+      end = (size_t)((uint8_t*)iter.pSize - (uint8_t*)dest) + sizeof(pb_size_t);
+      extent = MAX(extent, end);
+    }
+  } while (pb_field_iter_next(&iter));
+
+  return MIN(extent, (size_t)MAX_DECODE_SIZE);
+}
+
 /*
  * dispatch() - Process received message and jump to corresponding process
  * function
@@ -116,26 +154,34 @@ static bool pb_parse(const MessagesMap_t* entry, const uint8_t* msg,
  *     - msg: pointer to received message buffer
  *     - msg_size: size of message
  * OUTPUT
- *     none
+ *     true/false whether the message was parsed and handed to its handler
  *
  */
-static void dispatch(const MessagesMap_t* entry, const uint8_t* msg,
+static bool dispatch(const MessagesMap_t* entry, const uint8_t* msg,
                      uint32_t msg_size) {
   static uint8_t decode_buffer[MAX_DECODE_SIZE] __attribute__((aligned(4)));
-  memset(decode_buffer, 0, sizeof(decode_buffer));
+
+  /* Bytes of decode_buffer touched by the previous message. Everything past
+   * it is still zero, so only clear what either message covers. */
+  static size_t decode_used = sizeof(decode_buffer);
+
+  size_t extent = pb_struct_extent(entry->fields, decode_buffer);
+  memset(decode_buffer, 0, MAX(extent, decode_used));
+  decode_used = extent;
 
   if (!pb_parse(entry, msg, msg_size, decode_buffer)) {
     (*msg_failure)(FailureType_Failure_UnexpectedMessage,
                    "Could not parse protocol buffer message");
-    return;
+    return false;
   }
 
   if (!entry->process_func) {
     (*msg_failure)(FailureType_Failure_UnexpectedMessage, "Unexpected message");
-    return;
+    return false;
   }
 
   entry->process_func(decode_buffer);
+  return true;
 }
 
 /*
@@ -191,6 +237,198 @@ static void raw_dispatch(const MessagesMap_t* entry, const uint8_t* msg,
   })
 #endif
 
+typedef enum {
+  STREAM_KEY,    //< Reading a field key.
+  STREAM_VARINT, //< Copying a varint field value.
+  STREAM_LEN,    //< Reading the length of a length-delimited field.
+  STREAM_COPY,   //< Copying a fixed or length-delimited field value.
+  STREAM_DATA,   //< Handing the streamed field to its consumer.
+} StreamParseState;
+
+/* Top level wire-format parser for MSG_IN_STREAM messages. It runs over the
+ * fragments as they arrive, so no field needs to be complete within one
+ * fragment. */
+static struct {
+  const MessageStream* stream;
+  StreamParseState state;
+  uint8_t hdr[10];  //< Pending key / length varint.
+  size_t hdr_len;
+  uint32_t remaining;  //< Bytes left in the current STREAM_COPY/STREAM_DATA.
+  uint32_t total;      //< Length of the streamed field.
+  bool streamed;       //< Current length-delimited field is the streamed one.
+  bool seen;           //< The streamed field has been encountered.
+} rx_stream;
+
+/*
+ * stream_start() - Reset the stream parser for a new message
+ *
+ * INPUT
+ *     - stream: consumer of the streamed field
+ * OUTPUT
+ *     none
+ */
+static void stream_start(const MessageStream* stream) {
+  memset(&rx_stream, 0, sizeof(rx_stream));
+  rx_stream.stream = stream;
+  rx_stream.state = STREAM_KEY;
+
+  if (stream->begin) {
+    stream->begin();
+  }
+}
+
+/*
+ * stream_abort() - Notify the consumer that a started message was dropped
+ *
+ * INPUT
+ *     none
+ * OUTPUT
+ *     none
+ */
+static void stream_abort(void) {
+  if (rx_stream.stream && rx_stream.stream->abort) {
+    rx_stream.stream->abort();
+  }
+  rx_stream.stream = NULL;
+}
+
+/*
+ * stream_header_varint() - Accumulate one byte of a key / length varint
+ *
+ * INPUT
+ *     - byte: next input byte
+ *     - value: decoded value, once complete
+ * OUTPUT
+ *     1 when the varint is complete, 0 when more bytes are needed, -1 when it
+ *     is malformed
+ */
+static int stream_header_varint(uint8_t byte, uint64_t* value) {
+  if (rx_stream.hdr_len >= sizeof(rx_stream.hdr)) {
+    return -1;
+  }
+
+  rx_stream.hdr[rx_stream.hdr_len++] = byte;
+  if (byte & 0x80) {
+    return 0;
+  }
+
+  *value = 0;
+  for (size_t i = 0; i < rx_stream.hdr_len; i++) {
+    *value |= (uint64_t)(rx_stream.hdr[i] & 0x7f) << (7 * i);
+  }
+  return 1;
+}
+
+/*
+ * stream_feed() - Run the stream parser over a piece of the message, copying
+ * every field except the streamed one to the fragment buffer
+ *
+ * INPUT
+ *     - in: message bytes
+ *     - len: number of message bytes
+ *     - out: fragment buffer
+ *     - out_size: size of the fragment buffer
+ *     - cursor: number of bytes used in the fragment buffer
+ * OUTPUT
+ *     true/false whether the input was accepted
+ */
+static bool stream_feed(const uint8_t* in, size_t len, uint8_t* out,
+                        size_t out_size, size_t* cursor) {
+#define STREAM_EMIT(SRC, N)                     \
+  do {                                          \
+    if (out_size - *cursor < (N)) return false; \
+    memcpy(&out[*cursor], (SRC), (N));          \
+    *cursor += (N);                             \
+  } while (0)
+
+  const MessageStream* stream = rx_stream.stream;
+  uint64_t value;
+  int ret;
+
+  while (len) {
+    switch (rx_stream.state) {
+      case STREAM_KEY:
+        if ((ret = stream_header_varint(*in, &value)) < 0) return false;
+        in++;
+        len--;
+        if (!ret) break;
+
+        rx_stream.streamed = (value >> 3) == stream->tag;
+        if (rx_stream.streamed && (value & 7) != PB_WT_STRING) return false;
+        if (!rx_stream.streamed) {
+          STREAM_EMIT(rx_stream.hdr, rx_stream.hdr_len);
+        }
+        rx_stream.hdr_len = 0;
+
+        switch (value & 7) {
+          case PB_WT_VARINT:
+            rx_stream.state = STREAM_VARINT;
+            break;
+          case PB_WT_64BIT:
+            rx_stream.state = STREAM_COPY;
+            rx_stream.remaining = 8;
+            break;
+          case PB_WT_32BIT:
+            rx_stream.state = STREAM_COPY;
+            rx_stream.remaining = 4;
+            break;
+          case PB_WT_STRING:
+            rx_stream.state = STREAM_LEN;
+            break;
+          default:
+            return false;
+        }
+        break;
+
+      case STREAM_VARINT:
+        STREAM_EMIT(in, 1);
+        if (!(*in & 0x80)) rx_stream.state = STREAM_KEY;
+        in++;
+        len--;
+        break;
+
+      case STREAM_LEN:
+        if ((ret = stream_header_varint(*in, &value)) < 0) return false;
+        in++;
+        len--;
+        if (!ret) break;
+        if (value > UINT32_MAX) return false;
+
+        if (rx_stream.streamed) {
+          if (rx_stream.seen) return false;
+          rx_stream.seen = true;
+          rx_stream.total = (uint32_t)value;
+          rx_stream.state = STREAM_DATA;
+        } else {
+          STREAM_EMIT(rx_stream.hdr, rx_stream.hdr_len);
+          rx_stream.state = STREAM_COPY;
+        }
+        rx_stream.hdr_len = 0;
+        rx_stream.remaining = (uint32_t)value;
+        if (!rx_stream.remaining) rx_stream.state = STREAM_KEY;
+        break;
+
+      case STREAM_COPY:
+      case STREAM_DATA: {
+        size_t n = MIN(len, (size_t)rx_stream.remaining);
+        if (rx_stream.state == STREAM_COPY) {
+          STREAM_EMIT(in, n);
+        } else if (!stream->data(in, n, rx_stream.total)) {
+          return false;
+        }
+        in += n;
+        len -= n;
+        rx_stream.remaining -= n;
+        if (!rx_stream.remaining) rx_stream.state = STREAM_KEY;
+        break;
+      }
+    }
+  }
+
+  return true;
+#undef STREAM_EMIT
+}
+
 /// Common helper that handles USB messages from host
 void usb_rx_helper(const uint8_t* buf, size_t length, MessageMapType type) {
   static bool firstFrame = true;
@@ -201,12 +439,13 @@ void usb_rx_helper(const uint8_t* buf, size_t length, MessageMapType type) {
   static size_t
       cursor;  //< Index into msg where the current frame is to be written.
   static const MessagesMap_t* entry;
+  static uint32_t consumed;  //< Message bytes fed to the stream parser.
 
   if (firstFrame) {
     msgId = 0xffff;
     msgSize = 0;
-    memset(msg, 0, sizeof(msg));
     cursor = 0;
+    consumed = 0;
     entry = NULL;
   }
 
@@ -232,10 +471,10 @@ void usb_rx_helper(const uint8_t* buf, size_t length, MessageMapType type) {
   size_t frameSize;
 
   if (firstFrame) {
-    // Reset the buffer that we're writing fragments into.
-    memset(msg, 0, sizeof(msg));
+    // The fragment buffer was scrubbed over its used span on the last
+    // reset, so there is nothing to clear here.
 
-    // Then fish out the id / size, which are big-endian uint16 /
+    // Fish out the id / size, which are big-endian uint16 /
     // uint32's respectively.
     msgId = buf[4] | ((uint16_t)buf[3]) << 8;
     msgSize = buf[8] | ((uint32_t)buf[7]) << 8 | ((uint32_t)buf[6]) << 16 |
@@ -246,6 +485,11 @@ void usb_rx_helper(const uint8_t* buf, size_t length, MessageMapType type) {
 
     // And reset the cursor.
     cursor = 0;
+    consumed = 0;
+
+    if (entry && entry->dispatch == PARSABLE && entry->stream) {
+      stream_start(entry->stream);
+    }
 
     // Then take note of the fragment boundaries.
     frame = &buf[9];
@@ -272,6 +516,33 @@ void usb_rx_helper(const uint8_t* buf, size_t length, MessageMapType type) {
     return;
   }
 
+  if (entry->stream) {
+    // Fragments may be padded past the end of the message.
+    size_t n = MIN(frameSize, (size_t)(msgSize - consumed));
+    if (!stream_feed(frame, n, msg, sizeof(msg), &cursor)) {
+      (*msg_failure)(FailureType_Failure_UnexpectedMessage,
+                     "Malformed message");
+      goto reset;
+    }
+    consumed += n;
+
+    if (consumed < msgSize) {
+      firstFrame = false;
+      return;
+    }
+
+    if (rx_stream.state != STREAM_KEY || rx_stream.hdr_len) {
+      (*msg_failure)(FailureType_Failure_UnexpectedMessage,
+                     "Malformed message");
+      goto reset;
+    }
+
+    if (dispatch(entry, msg, cursor)) {
+      rx_stream.stream = NULL;
+    }
+    goto reset;
+  }
+
   size_t end;
   if (check_uadd_overflow(cursor, frameSize, &end) || sizeof(msg) < end) {
     (*msg_failure)(FailureType_Failure_UnexpectedMessage, "Malformed message");
@@ -294,9 +565,13 @@ void usb_rx_helper(const uint8_t* buf, size_t length, MessageMapType type) {
   dispatch(entry, msg, msgSize);
 
 reset:
+  if (rx_stream.stream) {
+    stream_abort();
+  }
   msgId = 0xffff;
   msgSize = 0;
-  memset(msg, 0, sizeof(msg));
+  // Only [0, cursor) was ever written for this message.
+  memset(msg, 0, cursor);
   cursor = 0;
   firstFrame = true;
   entry = NULL;
@@ -194,6 +194,14 @@ static void run_runnables(void) {
 }
 
 void kk_timer_init(void) {
+  /* Start from empty queues so re-initialization (libkkemu can be
+   * initialized and shut down repeatedly in one process) can't push the
+   * same node twice and link it into a cycle. */
+  free_queue.head = NULL;
+  free_queue.size = 0;
+  active_queue.head = NULL;
+  active_queue.size = 0;
+
   for (int i = 0; i < MAX_RUNNABLES; i++) {
     runnable_queue_push(&free_queue, &runnables[i]);
   }
@@ -350,6 +358,83 @@ void timerisr_usr(void) {
 
 #ifdef EMULATOR
 void tim4_sighandler(int sig) { timerisr_usr(); }
+
+/*
+ * timer_advance_ms() - Run the timer tick for elapsed milliseconds. Used by
+ * hosts that drive the firmware's time base themselves instead of through
+ * the SIGALRM handler installed by timer_init() (libkkemu).
+ *
+ * Ticks on which no runnable fires are skipped in bulk, so the cost depends
+ * on how many runnables fire rather than on ms. A repeating runnable that
+ * would fire several times during one call fires once, on its last due tick,
+ * and keeps its phase; a host catching up after a long idle stretch then
+ * doesn't replay every animation frame it missed.
+ *
+ * INPUT
+ *     - ms: number of 1 ms ticks to run
+ * OUTPUT
+ *     none
+ */
+void timer_advance_ms(uint32_t ms) {
+  while (ms > 0) {
+    /* Ticks up to and including the next one on which a runnable fires */
+    uint32_t due = ms;
+
+    for (RunnableNode* node = runnable_queue_peek(&active_queue);
+         node != NULL; node = node->next) {
+      uint32_t first = node->remaining ? node->remaining : 1;
+      if (first > ms) {
+        continue;
+      }
+
+      if (node->repeating) {
+        uint32_t last = node->period
+                            ? first + (ms - first) / node->period * node->period
+                            : ms;
+        node->remaining = last;
+        first = last;
+      }
+
+      if (first < due) {
+        due = first;
+      }
+    }
+
+    /* Nothing fires before tick `due`, so nothing reaches 0 here */
+    uint32_t skip = due - 1;
+    for (RunnableNode* node = runnable_queue_peek(&active_queue);
+         node != NULL; node = node->next) {
+      node->remaining -= skip;
+    }
+    remaining_delay = remaining_delay > skip ? remaining_delay - skip : 0;
+    timeSinceWakeup += skip;
+
+    timerisr_usr();
+    ms -= due;
+  }
+}
+
+/*
+ * timer_next_deadline_ms() - Ticks until the next active runnable fires
+ *
+ * INPUT
+ *     none
+ * OUTPUT
+ *     milliseconds until the earliest runnable is due (0 means on the next
+ *     tick), or UINT32_MAX if no runnable is scheduled
+ */
+uint32_t timer_next_deadline_ms(void) {
+  uint32_t next = UINT32_MAX;
+
+  for (const RunnableNode* node = runnable_queue_peek(&active_queue);
+       node != NULL; node = node->next) {
+    if (node->remaining < next) {
+      next = node->remaining;
+    }
+  }
+
+  return next;
+}
 #endif
 
 /*
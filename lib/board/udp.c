@@ -62,6 +62,9 @@ void usbPoll(void) {
       // msg_read_tiny(msg.message, sizeof(msg.message));
     }
   }
+
+  // Replies are batched; push out whatever the handler wrote.
+  emulatorSocketFlush();
 }
 
 bool usb_tx(const uint8_t* msg, uint32_t len) {
@@ -430,85 +430,121 @@ char usbTiny(char set) {
 
 #endif  // EMULATOR
 
-bool msg_write(MessageType msg_id, const void* msg) {
-  const pb_field_t* fields = message_fields(NORMAL_MSG, msg_id, OUT_MSG);
-
-  if (!fields) return false;
-
-  TrezorFrameBuffer framebuf;
-  memset(&framebuf, 0, sizeof(framebuf));
-  framebuf.frame.usb_header.hid_type = '?';
-  framebuf.frame.header.pre1 = '#';
-  framebuf.frame.header.pre2 = '#';
-  framebuf.frame.header.id = __builtin_bswap16(msg_id);
-
-  pb_ostream_t os =
-      pb_ostream_from_buffer(framebuf.buffer, sizeof(framebuf.buffer));
+/* Encoder sink that packs the framed message into HID reports and sends each
+ * report as soon as it fills, so the encoded message is never buffered. */
+typedef struct {
+  MessageMapType type;
+  size_t pos;
+  uint8_t report[64];
+} ReportWriter;
 
-  if (!pb_encode(&os, fields, msg)) return false;
-
-  framebuf.frame.header.len = __builtin_bswap32(os.bytes_written);
-
-  // Chunk out data
-  for (uint32_t pos = 1; pos < sizeof(framebuf.frame) + os.bytes_written;
-       pos += 64 - 1) {
-    uint8_t tmp_buffer[64] = {0};
-
-    tmp_buffer[0] = '?';
-
-    memcpy(tmp_buffer + 1, ((const uint8_t*)&framebuf) + pos, 64 - 1);
+/*
+ * report_flush() - Zero pad and send the current report, then start the next
+ * continuation report
+ *
+ * INPUT
+ *     - w: report writer
+ * OUTPUT
+ *     none
+ */
+static void report_flush(ReportWriter* w) {
+  memset(&w->report[w->pos], 0, sizeof(w->report) - w->pos);
 
 #ifndef EMULATOR
-    while (usbd_ep_write_packet(usbd_dev, ENDPOINT_ADDRESS_IN, tmp_buffer,
-                                64) == 0) {
-    };
+  uint8_t ep = ENDPOINT_ADDRESS_IN;
+#if DEBUG_LINK
+  if (w->type == DEBUG_MSG) ep = ENDPOINT_ADDRESS_DEBUG_IN;
+#endif
+  while (usbd_ep_write_packet(usbd_dev, ep, w->report, sizeof(w->report)) ==
+         0) {
+  };
 #else
-    emulatorSocketWrite(0, tmp_buffer, sizeof(tmp_buffer));
+  emulatorSocketWrite(w->type == NORMAL_MSG ? 0 : 1, w->report,
+                      sizeof(w->report));
 #endif
-  }
 
-  return true;
+  w->report[0] = '?';
+  w->pos = 1;
 }
 
-#if DEBUG_LINK
-bool msg_debug_write(MessageType msg_id, const void* msg) {
-  const pb_field_t* fields = message_fields(DEBUG_MSG, msg_id, OUT_MSG);
-
-  if (!fields) return false;
+static bool report_write(pb_ostream_t* stream, const uint8_t* buf,
+                         size_t count) {
+  ReportWriter* w = (ReportWriter*)stream->state;
 
-  TrezorFrameBuffer framebuf;
-  memset(&framebuf, 0, sizeof(framebuf));
-  framebuf.frame.usb_header.hid_type = '?';
-  framebuf.frame.header.pre1 = '#';
-  framebuf.frame.header.pre2 = '#';
-  framebuf.frame.header.id = __builtin_bswap16(msg_id);
+  while (count) {
+    size_t n = MIN(count, sizeof(w->report) - w->pos);
+    memcpy(&w->report[w->pos], buf, n);
+    w->pos += n;
+    buf += n;
+    count -= n;
 
-  pb_ostream_t os =
-      pb_ostream_from_buffer(framebuf.buffer, sizeof(framebuf.buffer));
+    if (w->pos == sizeof(w->report)) report_flush(w);
+  }
 
-  if (!pb_encode(&os, fields, msg)) return false;
+  return true;
+}
 
-  framebuf.frame.header.len = __builtin_bswap32(os.bytes_written);
+/*
+ * msg_write_framed() - Encode a message straight into '?##' framed HID
+ * reports on the given interface
+ *
+ * INPUT
+ *     - type: interface to send on
+ *     - msg_id: message id
+ *     - fields: protobuf field descriptors for msg
+ *     - msg: message struct
+ * OUTPUT
+ *     true/false whether the message was sent
+ */
+bool msg_write_framed(MessageMapType type, MessageType msg_id,
+                      const pb_field_t* fields, const void* msg) {
+  if (!fields) return false;
 
-  // Chunk out data
-  for (uint32_t pos = 1; pos < sizeof(framebuf.frame) + os.bytes_written;
-       pos += 64 - 1) {
-    uint8_t tmp_buffer[64] = {0};
+  size_t size;
+  if (!pb_get_encoded_size(&size, fields, msg)) return false;
+
+  // Same limit the host side reassembles into.
+  if (size > sizeof(((TrezorFrameBuffer*)0)->buffer)) return false;
+
+  ReportWriter w;
+  w.type = type;
+  w.report[0] = '?';
+  w.report[1] = '#';
+  w.report[2] = '#';
+  w.report[3] = (msg_id >> 8) & 0xff;
+  w.report[4] = msg_id & 0xff;
+  w.report[5] = (size >> 24) & 0xff;
+  w.report[6] = (size >> 16) & 0xff;
+  w.report[7] = (size >> 8) & 0xff;
+  w.report[8] = size & 0xff;
+  w.pos = 9;
+
+  pb_ostream_t os = {.callback = report_write, .state = &w, .max_size = size};
+  bool ok = pb_encode(&os, fields, msg);
+
+  // The header is already out, so keep the framing intact for the host even
+  // if encoding stopped early.
+  static const uint8_t zeros[64];
+  while (os.bytes_written < size) {
+    size_t n = MIN(size - os.bytes_written, sizeof(zeros));
+    report_write(&os, zeros, n);
+    os.bytes_written += n;
+  }
 
-    tmp_buffer[0] = '?';
+  if (w.pos > 1) report_flush(&w);
 
-    memcpy(tmp_buffer + 1, ((const uint8_t*)&framebuf) + pos, 64 - 1);
+  return ok;
+}
 
-#ifndef EMULATOR
-    while (usbd_ep_write_packet(usbd_dev, ENDPOINT_ADDRESS_DEBUG_IN, tmp_buffer,
-                                64) == 0) {
-    };
-#else
-    emulatorSocketWrite(1, tmp_buffer, sizeof(tmp_buffer));
-#endif
-  }
+bool msg_write(MessageType msg_id, const void* msg) {
+  return msg_write_framed(NORMAL_MSG, msg_id,
+                          message_fields(NORMAL_MSG, msg_id, OUT_MSG), msg);
+}
 
-  return true;
+#if DEBUG_LINK
+bool msg_debug_write(MessageType msg_id, const void* msg) {
+  return msg_write_framed(DEBUG_MSG, msg_id,
+                          message_fields(DEBUG_MSG, msg_id, OUT_MSG), msg);
 }
 #endif
 
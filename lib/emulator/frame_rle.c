@@ -0,0 +1,70 @@
+/*
+ * Run-length codec for the libkkemu frame stream.
+ */
+#include "frame_rle.h"
+
+size_t frame_rle_encode(const uint8_t* cur, const uint8_t* prev,
+                        uint8_t* out) {
+#define FRAME_BYTE(I) ((uint8_t)(cur[I] ^ (prev ? prev[I] : 0)))
+  size_t o = 0;
+  size_t i = 0;
+
+  while (i < FRAME_RLE_PACKED_SIZE) {
+    uint8_t v = FRAME_BYTE(i);
+    size_t run = 1;
+    while (i + run < FRAME_RLE_PACKED_SIZE && run < 127 &&
+           FRAME_BYTE(i + run) == v) {
+      run++;
+    }
+
+    if (run >= 3) {
+      out[o++] = (uint8_t)run;
+      out[o++] = v;
+      i += run;
+      continue;
+    }
+
+    /* Literals up to the next run of 3 */
+    size_t lit = 0;
+    size_t count_at = o++;
+    while (i < FRAME_RLE_PACKED_SIZE && lit < 128) {
+      uint8_t b = FRAME_BYTE(i);
+      if (i + 2 < FRAME_RLE_PACKED_SIZE && FRAME_BYTE(i + 1) == b &&
+          FRAME_BYTE(i + 2) == b) {
+        break;
+      }
+      out[o++] = b;
+      lit++;
+      i++;
+    }
+    out[count_at] = (uint8_t)(-(int)lit);
+  }
+
+  return o;
+#undef FRAME_BYTE
+}
+
+bool frame_rle_apply(uint8_t* frame, const uint8_t* rec, size_t len,
+                     bool delta) {
+  size_t i = 0, o = 0;
+  while (i < len) {
+    int8_t count = (int8_t)rec[i++];
+    size_t n = count < 0 ? (size_t)-count : (size_t)count;
+    if (n == 0 || o + n > FRAME_RLE_PACKED_SIZE) return false;
+
+    if (count > 0) {
+      if (i >= len) return false;
+      uint8_t v = rec[i++];
+      for (size_t k = 0; k < n; k++, o++) {
+        frame[o] = delta ? frame[o] ^ v : v;
+      }
+    } else {
+      if (i + n > len) return false;
+      for (size_t k = 0; k < n; k++, o++, i++) {
+        frame[o] = delta ? frame[o] ^ rec[i] : rec[i];
+      }
+    }
+  }
+
+  return o == FRAME_RLE_PACKED_SIZE;
+}
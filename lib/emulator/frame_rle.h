@@ -0,0 +1,41 @@
+/*
+ * Run-length codec for the libkkemu frame stream. A record decodes to one
+ * packed 2048-byte frame, or to its XOR with the previous frame, using the
+ * int8 run/literal scheme Image data uses (see draw_bitmap_mono_rle()): a
+ * positive count n is followed by one byte repeated n times, a negative
+ * count -n by n literal bytes.
+ */
+#ifndef FRAME_RLE_H
+#define FRAME_RLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_RLE_PACKED_SIZE 2048
+/* Largest record: all literals, one count byte per 128 of them */
+#define FRAME_RLE_MAX (FRAME_RLE_PACKED_SIZE + FRAME_RLE_PACKED_SIZE / 128)
+
+/*
+ * Encode `cur`, XORed with `prev` when it is not NULL, into `out` (at least
+ * FRAME_RLE_MAX bytes). Returns the record length.
+ */
+size_t frame_rle_encode(const uint8_t* cur, const uint8_t* prev, uint8_t* out);
+
+/*
+ * Decode a record onto `frame`: overwrite it, or XOR into it when `delta`.
+ * Returns false if the record is malformed or does not cover exactly
+ * FRAME_RLE_PACKED_SIZE bytes; `frame` may then be partly written.
+ */
+bool frame_rle_apply(uint8_t* frame, const uint8_t* rec, size_t len,
+                     bool delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,9 +1,20 @@
 /*
  * libkkemu — KeepKey firmware emulator as a shared library.
  *
- * Replaces main() with kkemu_init/poll/shutdown. Uses ring buffers
+ * Replaces main() with kkemu_create/poll/destroy. Uses ring buffers
  * instead of UDP sockets for message I/O.
+ *
+ * The firmware below us (storage shadow, session, FSM, canvas, timers, the
+ * flash base) keeps its state in file-scope statics across dozens of
+ * translation units. All of them live in this library's writable data, so
+ * each handle keeps its own copy of that data and swaps it in before it
+ * runs any firmware code (see "Firmware state" below).
  */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* dl_iterate_phdr */
+#endif
+
 #include "keepkey/emulator/libkkemu.h"
 #include "keepkey/emulator/emulator.h"
 #include "keepkey/emulator/setup.h"
@@ -18,51 +29,365 @@
 #include "keepkey/firmware/home_sm.h"
 #include "keepkey/firmware/storage.h"
 #include "keepkey/rand/rng.h"
+#include "frame_rle.h"
 #include "ringbuf.h"
 #include "trezor/crypto/memzero.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <time.h>
 
-/* Defined in firmware — we just need the declaration */
+#if defined(__APPLE__)
+#include <dlfcn.h>
+#include <mach-o/getsect.h>
+#include <mach-o/loader.h>
+#else
+#include <link.h>
+#endif
+
+/* Defined in firmware — we just need the declarations */
 extern void fsm_init(void);
+extern uint32_t ethereum_setDataChunking(uint32_t chunk_size, bool stream);
+
+/* ── Display capture stream ─────────────────────────────────────────── */
+
+/*
+ * Every display_refresh() that changes the 1-bit packed screen appends a
+ * record to a byte ring: a keyframe (the packed frame) or a delta (the
+ * packed frame XORed with the previous one), both run-length encoded with
+ * the int8 run/literal scheme Image data uses (see frame_rle.h).
+ * Static screens therefore cost a few dozen bytes per frame instead of 2 KB.
+ *
+ * Each delta is against the frame of the record queued just before it, so
+ * records only decode when applied in order, every one of them. Popping
+ * does that: kkemu_pop_frame_rle() hands the record out raw and also
+ * applies it to host_frame, which kkemu_pop_frame() returns, so the two may
+ * be mixed freely. If the host falls behind and a record does not fit,
+ * every queued record is discarded (counted in frames_dropped) and the new
+ * frame is queued as a keyframe, so a reader never sees a delta whose base
+ * it missed.
+ */
+#define FRAME_PACKED_SIZE 2048
+#define FRAME_STREAM_SIZE (32 * 1024)
+#define FRAME_KEY_INTERVAL 32
+#define FRAME_RECORD_HEADER_LEN 3 /* kind, u16 LE payload length */
+
+_Static_assert(FRAME_PACKED_SIZE == FRAME_RLE_PACKED_SIZE &&
+                   KKEMU_FRAME_RLE_MAX == FRAME_RLE_MAX,
+               "frame stream sizes must match the codec");
 
-/* ── Ring buffers (replace UDP sockets) ─────────────────────────────── */
+/*
+ * '?##' framing used on the HID interfaces: the first report carries
+ * '?', '#', '#', a big-endian u16 message id, a big-endian u32 payload
+ * length and then payload; continuation reports carry '?' and payload.
+ */
+#define FRAME_FIRST_HEADER_LEN 9
+#define FRAME_CONT_HEADER_LEN 1
 
-static RingBuf rb_main_in;   /* host → firmware (main interface) */
-static RingBuf rb_main_out;  /* firmware → host (main interface) */
-static RingBuf rb_debug_in;  /* host → firmware (debug link) */
-static RingBuf rb_debug_out; /* firmware → host (debug link) */
+/*
+ * A whole frame of KKEMU_MESSAGE_MAX bytes fits in a ring with one slot to
+ * spare, which libkkemu_socketWrite() keeps free to report a lost message.
+ */
+_Static_assert(1 +
+                       (KKEMU_MESSAGE_MAX -
+                        (RINGBUF_SLOT_SIZE - FRAME_FIRST_HEADER_LEN) +
+                        (RINGBUF_SLOT_SIZE - FRAME_CONT_HEADER_LEN) - 1) /
+                           (RINGBUF_SLOT_SIZE - FRAME_CONT_HEADER_LEN) <
+                   RINGBUF_CAPACITY - 1,
+               "KKEMU_MESSAGE_MAX does not fit in the rings");
 
-static int libkkemu_initialized = 0;
+/* Header announcing a message dropped because its ring was full */
+#define FRAME_LOST_LEN UINT32_MAX
 
-/* ── Display capture ring ───────────────────────────────────────────── */
+/* ── Emulator state ─────────────────────────────────────────────────── */
 
 /*
- * Captures every display_refresh() into a ring of 1-bit packed snapshots.
- * The host drains via kkemu_pop_frame(). Adjacent identical frames are
- * skipped so an idle firmware doesn't spam the ring.
+ * Everything the library itself owns for one emulated device, in one place
+ * so that kkemu_destroy() can zero it as a whole.
+ */
+struct kkemu_ctx {
+  /* Ring buffers (replace UDP sockets) */
+  RingBuf main_in;   /* host → firmware (main interface) */
+  RingBuf main_out;  /* firmware → host (main interface) */
+  RingBuf debug_in;  /* host → firmware (debug link) */
+  RingBuf debug_out; /* firmware → host (debug link) */
+
+  /*
+   * '?##' framing state of the two output rings, indexed by interface.
+   * Producer side: continuation reports still to come of the frame the
+   * firmware is writing, and whether they are swallowed because the frame
+   * did not fit. Consumer side: continuation reports of a frame the host
+   * began with kkemu_read(), which kkemu_recv_message() has to step over.
+   */
+  uint32_t out_cont[2];
+  bool out_drop[2];
+  uint32_t out_skip[2];
+
+  /* Display capture */
+  uint8_t frame_stream[FRAME_STREAM_SIZE];
+  uint32_t stream_head;    /* monotonic byte offset, mod FRAME_STREAM_SIZE */
+  uint32_t stream_tail;    /* monotonic byte offset */
+  uint32_t stream_records; /* records queued */
+  uint32_t since_key;      /* records queued since the last keyframe */
+  uint32_t frames_dropped; /* cumulative */
+  uint8_t last_packed[FRAME_PACKED_SIZE];
+  int last_packed_valid;
+  uint8_t capture_scratch[FRAME_PACKED_SIZE];
+  uint8_t rle_scratch[KKEMU_FRAME_RLE_MAX];
+  /* Host side reconstruction used by kkemu_pop_frame() */
+  uint8_t host_frame[FRAME_PACKED_SIZE];
+
+  /* Scratch returned by kkemu_get_display() */
+  uint8_t display_packed_scratch[FRAME_PACKED_SIZE];
+
+  /* kkemu_poll_wait() sleeps here; kkemu_write() signals it */
+  pthread_mutex_t wake_lock;
+  pthread_cond_t wake_cond;
+
+  /* Host time the firmware timer was last advanced to (CLOCK_MONOTONIC) */
+  struct timespec last_tick;
+
+  /* Host-owned flash buffer the firmware reads and writes */
+  uint8_t* flash_buf;
+
+  /* Flash sectors written since the host last cleared them, by number */
+  uint32_t flash_dirty;
+  /* Whether the last firmware call wrote any, so commit_cb is due */
+  bool flash_committed;
+
+  /* Called after each poll that wrote to the flash buffer */
+  kkemu_commit_cb commit_cb;
+  void* commit_user;
+
+  /* This device's firmware state while another handle's is in memory */
+  uint8_t* image;
+
+  /* Being destroyed: its firmware state is gone, only the rings are left */
+  bool closing;
+};
+
+/* ── Firmware state ─────────────────────────────────────────────────── */
+
+/*
+ * The firmware's statics are this library's writable data: .data and .bss
+ * on ELF, __data/__bss/__common on Mach-O. A handle's firmware state is a
+ * copy of those bytes. Before running firmware code for a handle, the
+ * bytes of whichever handle is live are saved to its image and the
+ * handle's own image is copied in. A new handle starts from the bytes as
+ * they were before any firmware ran.
  *
- * Sized for ~4 seconds at 16ms refresh; if the host falls behind the
- * oldest frames are dropped (write advances past read).
+ * `host` is the only state shared by all handles. It is cut out of the
+ * swapped regions, so it is never overwritten by a swap. Firmware code
+ * only ever runs with host.lock held, so one handle is live at a time;
+ * handles take turns rather than running in parallel.
+ *
+ * AddressSanitizer keeps redzones between globals and rejects the copies,
+ * so don't build the library with it.
  */
-#define FRAME_PACKED_SIZE 2048
-#define FRAME_RING_SIZE 64
+#define FIRMWARE_REGIONS_MAX 8
+
+typedef struct {
+  uint8_t* start;
+  size_t len;
+} FirmwareRegion;
+
+static struct {
+  /* Held while firmware code runs or the firmware state is swapped */
+  pthread_mutex_t lock;
+
+  /* Handle whose firmware state is in memory, if any */
+  kkemu_ctx* live;
+
+  /* Writable data of this library, without `host` itself */
+  FirmwareRegion regions[FIRMWARE_REGIONS_MAX];
+  size_t region_count;
+  size_t image_len;
+
+  /* The regions as they were before any firmware code ran */
+  uint8_t* pristine;
+
+  /* Handle behind kkemu_init() and the rest of the single-device API */
+  kkemu_ctx* device;
+
+  /*
+   * Dirty sectors as of kkemu_shutdown(), so the host can still ask which
+   * ranges to persist once the emulator is gone.
+   */
+  uint32_t shutdown_dirty;
+} host = {PTHREAD_MUTEX_INITIALIZER};
+
+/* Add [start, start + len) to the swapped regions, minus `host` */
+static bool libkkemu_add_region(uint8_t* start, size_t len) {
+  uint8_t* end = start + len;
+  uint8_t* host_start = (uint8_t*)&host;
+  uint8_t* host_end = host_start + sizeof(host);
+
+  if (host_start >= start && host_end <= end) {
+    return libkkemu_add_region(start, (size_t)(host_start - start)) &&
+           libkkemu_add_region(host_end, (size_t)(end - host_end));
+  }
+
+  if (!len) return true;
+  if (host.region_count == FIRMWARE_REGIONS_MAX) return false;
+  host.regions[host.region_count].start = start;
+  host.regions[host.region_count].len = len;
+  host.region_count++;
+  host.image_len += len;
+  return true;
+}
+
+#if defined(__APPLE__)
+
+static bool libkkemu_find_regions(void) {
+  static const char* const segments[] = {"__DATA", "__DATA_DIRTY"};
+  static const char* const sections[] = {"__data", "__bss", "__common"};
+
+  Dl_info info;
+  if (!dladdr((const void*)&host, &info) || !info.dli_fbase) return false;
+  const struct mach_header_64* mh =
+      (const struct mach_header_64*)info.dli_fbase;
+
+  /* Statically linked into the host program, we'd swap its data too */
+  if (mh->filetype != MH_DYLIB && mh->filetype != MH_BUNDLE) return false;
+
+  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+    for (size_t j = 0; j < sizeof(sections) / sizeof(sections[0]); j++) {
+      unsigned long len = 0;
+      uint8_t* start = getsectiondata(mh, segments[i], sections[j], &len);
+      if (start && !libkkemu_add_region(start, len)) return false;
+    }
+  }
+  return host.region_count > 0;
+}
+
+#else
+
+/*
+ * Our writable PT_LOAD segment, minus the PT_GNU_RELRO part at its start
+ * that the loader makes read-only. The library is linked with -z now, so
+ * the GOT is all in the RELRO part and never swapped.
+ */
+static int libkkemu_phdr_callback(struct dl_phdr_info* info, size_t size,
+                                  void* data) {
+  (void)size;
+  bool* found = (bool*)data;
+  uintptr_t self = (uintptr_t)&host;
+  uintptr_t start = 0, end = 0, relro_start = 0, relro_end = 0;
+
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+    uintptr_t vaddr = info->dlpi_addr + phdr->p_vaddr;
+    if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_W) &&
+        self >= vaddr && self < vaddr + phdr->p_memsz) {
+      start = vaddr;
+      end = vaddr + phdr->p_memsz;
+    } else if (phdr->p_type == PT_GNU_RELRO) {
+      relro_start = vaddr;
+      relro_end = vaddr + phdr->p_memsz;
+    }
+  }
+  if (!start) return 0;
+
+  /* Statically linked into the host program, we'd swap its data too */
+  if (!info->dlpi_name || !info->dlpi_name[0]) return 1;
+
+  if (relro_start <= start && relro_end > start) start = relro_end;
+  *found = start < end &&
+           libkkemu_add_region((uint8_t*)start, (size_t)(end - start));
+  return 1;
+}
+
+static bool libkkemu_find_regions(void) {
+  bool found = false;
+  dl_iterate_phdr(libkkemu_phdr_callback, &found);
+  return found;
+}
+
+#endif
+
+static void libkkemu_save_firmware(uint8_t* image) {
+  for (size_t i = 0; i < host.region_count; i++) {
+    memcpy(image, host.regions[i].start, host.regions[i].len);
+    image += host.regions[i].len;
+  }
+}
+
+static void libkkemu_load_firmware(const uint8_t* image) {
+  for (size_t i = 0; i < host.region_count; i++) {
+    memcpy(host.regions[i].start, image, host.regions[i].len);
+    image += host.regions[i].len;
+  }
+}
+
+/*
+ * Find the firmware's state and keep a copy of it from before any firmware
+ * code ran, once per process. Called with host.lock held.
+ */
+static bool libkkemu_setup(void) {
+  if (host.pristine) return true;
+
+  host.region_count = 0;
+  host.image_len = 0;
+  if (!libkkemu_find_regions()) {
+    fprintf(stderr,
+            "[libkkemu] can't locate the firmware's writable data; is "
+            "libkkemu loaded as a shared library?\n");
+    return false;
+  }
+
+  /*
+   * One /dev/urandom descriptor for every handle: open it before the copy
+   * is taken, so each handle's image already holds it.
+   */
+  setup_urandom_only();
 
-static uint8_t frame_ring[FRAME_RING_SIZE][FRAME_PACKED_SIZE];
-static uint8_t last_packed[FRAME_PACKED_SIZE];
-static int last_packed_valid = 0;
-static uint32_t frame_write_idx =
-    0; /* monotonic, mod FRAME_RING_SIZE for slot */
-static uint32_t frame_read_idx = 0; /* monotonic */
+  uint8_t* pristine = malloc(host.image_len);
+  if (!pristine) return false;
+  libkkemu_save_firmware(pristine);
+
+  /* The live firmware state holds secrets too, see kkemu_create() */
+  for (size_t i = 0; i < host.region_count; i++) {
+    if (mlock(host.regions[i].start, host.regions[i].len) != 0) {
+      fprintf(stderr,
+              "[libkkemu] mlock(%zu bytes) failed: %s — firmware state may "
+              "be swapped to disk; do not load production secrets\n",
+              host.regions[i].len, strerror(errno));
+    }
+  }
+
+  host.pristine = pristine;
+  return true;
+}
 
 /*
- * Scratch returned by kkemu_get_display(). File-scope (not function-static)
- * so kkemu_shutdown() can zero it alongside the other display buffers.
+ * Put ctx's firmware state in memory, or the pristine state for NULL.
+ * Called with host.lock held.
  */
-static uint8_t display_packed_scratch[FRAME_PACKED_SIZE];
+static void libkkemu_switch(kkemu_ctx* ctx) {
+  if (host.live == ctx) return;
+  if (host.live) libkkemu_save_firmware(host.live->image);
+  libkkemu_load_firmware(ctx ? ctx->image : host.pristine);
+  host.live = ctx;
+}
+
+/* Run firmware code for ctx until libkkemu_leave() */
+static void libkkemu_enter(kkemu_ctx* ctx) {
+  pthread_mutex_lock(&host.lock);
+  libkkemu_switch(ctx);
+}
+
+static void libkkemu_leave(kkemu_ctx* ctx) {
+  bool committed = ctx->flash_committed;
+  ctx->flash_committed = false;
+  pthread_mutex_unlock(&host.lock);
+
+  /* Outside the lock, so the callback may call back into the library */
+  if (committed && ctx->commit_cb) ctx->commit_cb(ctx->commit_user);
+}
 
 /* ── Replacement I/O functions ──────────────────────────────────────── */
 
@@ -72,84 +397,242 @@ static uint8_t display_packed_scratch[FRAME_PACKED_SIZE];
  */
 
 void libkkemu_socketInit(void) {
-  ringbuf_init(&rb_main_in);
-  ringbuf_init(&rb_main_out);
-  ringbuf_init(&rb_debug_in);
-  ringbuf_init(&rb_debug_out);
+  kkemu_ctx* ctx = host.live;
+  ringbuf_init(&ctx->main_in);
+  ringbuf_init(&ctx->main_out);
+  ringbuf_init(&ctx->debug_in);
+  ringbuf_init(&ctx->debug_out);
 }
 
 size_t libkkemu_socketRead(int* iface, void* buffer, size_t size) {
-  if (ringbuf_pop(&rb_main_in, (uint8_t*)buffer, size)) {
+  kkemu_ctx* ctx = host.live;
+  if (ringbuf_pop(&ctx->main_in, (uint8_t*)buffer, size)) {
     *iface = 0;
     return size < RINGBUF_SLOT_SIZE ? size : RINGBUF_SLOT_SIZE;
   }
-  if (ringbuf_pop(&rb_debug_in, (uint8_t*)buffer, size)) {
+  if (ringbuf_pop(&ctx->debug_in, (uint8_t*)buffer, size)) {
     *iface = 1;
     return size < RINGBUF_SLOT_SIZE ? size : RINGBUF_SLOT_SIZE;
   }
   return 0;
 }
 
+static bool libkkemu_is_header(const uint8_t* report) {
+  return report[0] == '?' && report[1] == '#' && report[2] == '#';
+}
+
+static uint32_t libkkemu_header_len(const uint8_t* report) {
+  return (uint32_t)report[5] << 24 | (uint32_t)report[6] << 16 |
+         (uint32_t)report[7] << 8 | (uint32_t)report[8];
+}
+
+/* Number of HID reports a '?##' frame with `len` payload bytes occupies */
+static size_t libkkemu_frame_reports(size_t len) {
+  const size_t first = RINGBUF_SLOT_SIZE - FRAME_FIRST_HEADER_LEN;
+  const size_t cont = RINGBUF_SLOT_SIZE - FRAME_CONT_HEADER_LEN;
+  if (len <= first) return 1;
+  return 1 + (len - first + cont - 1) / cont;
+}
+
+/*
+ * The firmware writes a message one report at a time, so whether all of it
+ * fits is decided at its first report. If it doesn't, a first report alone
+ * is queued in its place, announcing more than KKEMU_MESSAGE_MAX bytes (the
+ * real length if the message is too large, FRAME_LOST_LEN if the ring was
+ * full), and the rest of the frame is swallowed. Readers therefore only
+ * ever see whole frames. A slot is kept free for that report, so of a run
+ * of lost messages at least the first one is reported.
+ */
 size_t libkkemu_socketWrite(int iface, const void* buffer, size_t size) {
-  RingBuf* rb = (iface == 0) ? &rb_main_out : &rb_debug_out;
-  if (!ringbuf_push(rb, (const uint8_t*)buffer, size)) return 0;
+  kkemu_ctx* ctx = host.live;
+  int out = iface == 0 ? 0 : 1;
+  RingBuf* rb = out == 0 ? &ctx->main_out : &ctx->debug_out;
+  const uint8_t* report = (const uint8_t*)buffer;
+
+  if (ctx->out_cont[out]) {
+    ctx->out_cont[out]--;
+    if (ctx->out_drop[out]) return 0;
+  } else if (size >= FRAME_FIRST_HEADER_LEN && libkkemu_is_header(report)) {
+    uint32_t len = libkkemu_header_len(report);
+    size_t reports = libkkemu_frame_reports(len);
+    ctx->out_cont[out] = reports - 1;
+    ctx->out_drop[out] =
+        len > KKEMU_MESSAGE_MAX || reports >= ringbuf_space(rb);
+    if (ctx->out_drop[out]) {
+      uint32_t lost = len > KKEMU_MESSAGE_MAX ? len : FRAME_LOST_LEN;
+      uint8_t header[FRAME_FIRST_HEADER_LEN];
+      memcpy(header, report, 5);
+      header[5] = (uint8_t)(lost >> 24);
+      header[6] = (uint8_t)(lost >> 16);
+      header[7] = (uint8_t)(lost >> 8);
+      header[8] = (uint8_t)lost;
+      ringbuf_push(rb, header, sizeof(header));
+      return 0;
+    }
+  }
+
+  if (!ringbuf_push(rb, report, size)) return 0;
   return size;
 }
 
 /* ── Display capture callback ───────────────────────────────────────── */
 
+static void libkkemu_stream_put(kkemu_ctx* ctx, const uint8_t* data,
+                                size_t len) {
+  size_t off = ctx->stream_head % FRAME_STREAM_SIZE;
+  size_t n = FRAME_STREAM_SIZE - off < len ? FRAME_STREAM_SIZE - off : len;
+  memcpy(&ctx->frame_stream[off], data, n);
+  memcpy(ctx->frame_stream, data + n, len - n);
+  ctx->stream_head += len;
+}
+
+static void libkkemu_stream_get(kkemu_ctx* ctx, uint32_t pos, uint8_t* data,
+                                size_t len) {
+  size_t off = pos % FRAME_STREAM_SIZE;
+  size_t n = FRAME_STREAM_SIZE - off < len ? FRAME_STREAM_SIZE - off : len;
+  memcpy(data, &ctx->frame_stream[off], n);
+  memcpy(data + n, ctx->frame_stream, len - n);
+}
+
+/* Queue `packed` as the next record of the frame stream */
+static void libkkemu_stream_frame(kkemu_ctx* ctx, const uint8_t* packed) {
+  int kind = KKEMU_FRAME_DELTA;
+  /*
+   * A host that keeps up pops each record before the next one arrives; the
+   * frame it decoded last is still last_packed, so a delta is fine even on
+   * an empty queue. Drops are turned into keyframes below.
+   */
+  if (!ctx->last_packed_valid || ctx->since_key + 1 >= FRAME_KEY_INTERVAL) {
+    kind = KKEMU_FRAME_KEY;
+  }
+
+  size_t len = frame_rle_encode(
+      packed, kind == KKEMU_FRAME_DELTA ? ctx->last_packed : NULL,
+      ctx->rle_scratch);
+
+  if (FRAME_STREAM_SIZE - (ctx->stream_head - ctx->stream_tail) <
+      FRAME_RECORD_HEADER_LEN + len) {
+    /* Host fell behind: drop everything queued, restart from a keyframe */
+    ctx->frames_dropped += ctx->stream_records;
+    ctx->stream_tail = ctx->stream_head;
+    ctx->stream_records = 0;
+    if (kind == KKEMU_FRAME_DELTA) {
+      kind = KKEMU_FRAME_KEY;
+      len = frame_rle_encode(packed, NULL, ctx->rle_scratch);
+    }
+  }
+
+  uint8_t hdr[FRAME_RECORD_HEADER_LEN] = {(uint8_t)kind, (uint8_t)len,
+                                         (uint8_t)(len >> 8)};
+  libkkemu_stream_put(ctx, hdr, sizeof(hdr));
+  libkkemu_stream_put(ctx, ctx->rle_scratch, len);
+  ctx->stream_records++;
+  ctx->since_key = kind == KKEMU_FRAME_KEY ? 0 : ctx->since_key + 1;
+}
+
 /*
  * Pack the 8-bpp grayscale canvas (256x64 = 16384 bytes) into the
- * 1-bit SSD1306 page format the host wants. Skip if identical to the
- * last frame we captured. Called from display_refresh() on every poll
- * and on every iteration of confirm_helper's busy loop.
+ * 1-bit SSD1306 page format the host wants. Only the pages and columns
+ * under `changed` are repacked; a frame is queued only if that actually
+ * altered the packed image. Called from display_refresh() on every poll
+ * and on every iteration of confirm_helper's busy loop, so an idle screen
+ * costs nothing.
  */
-static void libkkemu_capture_frame(const uint8_t* canvas_buf) {
+static void libkkemu_capture_frame(const uint8_t* canvas_buf,
+                                   const CanvasRect* changed) {
+  kkemu_ctx* ctx = host.live;
   if (!canvas_buf) return;
 
-  uint8_t* slot = frame_ring[frame_write_idx % FRAME_RING_SIZE];
-  memset(slot, 0, FRAME_PACKED_SIZE);
-  for (int x = 0; x < 256; x++) {
-    for (int y = 0; y < 64; y++) {
-      if (canvas_buf[y * 256 + x] > 0) {
-        slot[x + (y / 8) * 256] |= (uint8_t)(1u << (y % 8));
-      }
-    }
+  uint16_t x0 = 0, x1 = 256, p0 = 0, p1 = 64 / 8;
+  if (ctx->last_packed_valid) {
+    if (!changed || !changed->width || !changed->height) return;
+    x0 = changed->x;
+    x1 = changed->x + changed->width;
+    p0 = changed->y / 8;
+    p1 = (changed->y + changed->height + 7) / 8;
   }
 
+  /* Repack on top of the last frame */
+  uint8_t* packed = ctx->capture_scratch;
+  memcpy(packed, ctx->last_packed, FRAME_PACKED_SIZE);
+  canvas_pack_mono(canvas_buf, 256, x0, x1, p0, p1, packed);
+
   /* Dedup: skip if identical to last captured */
-  if (last_packed_valid && memcmp(slot, last_packed, FRAME_PACKED_SIZE) == 0) {
-    return;
+  if (ctx->last_packed_valid) {
+    int differs = 0;
+    for (uint16_t p = p0; p < p1 && !differs; p++) {
+      differs = memcmp(&packed[p * 256 + x0], &ctx->last_packed[p * 256 + x0],
+                       x1 - x0) != 0;
+    }
+    if (!differs) return;
   }
-  memcpy(last_packed, slot, FRAME_PACKED_SIZE);
-  last_packed_valid = 1;
 
-  frame_write_idx++;
-  /* Drop oldest if host fell behind */
-  if (frame_write_idx - frame_read_idx > FRAME_RING_SIZE) {
-    frame_read_idx = frame_write_idx - FRAME_RING_SIZE;
+  libkkemu_stream_frame(ctx, packed);
+  memcpy(ctx->last_packed, packed, FRAME_PACKED_SIZE);
+  ctx->last_packed_valid = 1;
+}
+
+/* ── Dirty flash tracking ───────────────────────────────────────────── */
+
+/*
+ * Move the sectors the firmware wrote since the last call into the handle,
+ * and have libkkemu_leave() tell the host if there were any. Storage
+ * commits happen inside usbPoll()/storage_flush(), so calling this at the
+ * end of each poll gives the host one notification per batch of commits.
+ */
+static void libkkemu_collect_dirty(void) {
+  kkemu_ctx* ctx = host.live;
+  uint32_t dirty = flash_getDirty();
+  if (!dirty) return;
+
+  flash_clearDirty();
+  ctx->flash_dirty |= dirty;
+  ctx->flash_committed = true;
+}
+
+/* List the sectors in `dirty` as flash_buf ranges, merging neighbours */
+static int libkkemu_dirty_ranges(uint32_t dirty, kkemu_flash_range* ranges,
+                                 size_t max_ranges) {
+  if (max_ranges && !ranges) return -1;
+
+  /* One bit per sector bounds the number of ranges */
+  FlashRange found[32];
+  size_t count = flash_dirtyRanges(dirty, found, 32);
+  for (size_t i = 0; i < count && i < max_ranges; i++) {
+    ranges[i].offset = found[i].offset;
+    ranges[i].len = found[i].len;
   }
+
+  return (int)count;
 }
 
 /* ── Public API ─────────────────────────────────────────────────────── */
 
-int kkemu_init(uint8_t* flash_buf, size_t flash_len) {
-  if (flash_len != KKEMU_FLASH_SIZE) return -1;
-  if (!flash_buf) return -1;
-  if (libkkemu_initialized) return -1;
+kkemu_ctx* kkemu_create(uint8_t* flash_buf, size_t flash_len) {
+  if (flash_len != KKEMU_FLASH_SIZE) return NULL;
+  if (!flash_buf) return NULL;
 
-  /* Point firmware's flash pointer at the host-provided buffer */
-  emulator_flash_base = flash_buf;
+  kkemu_ctx* ctx = calloc(1, sizeof(*ctx));
+  if (!ctx) return NULL;
+
+  pthread_mutex_lock(&host.lock);
+  if (!libkkemu_setup() || !(ctx->image = malloc(host.image_len))) {
+    pthread_mutex_unlock(&host.lock);
+    free(ctx);
+    return NULL;
+  }
+  memcpy(ctx->image, host.pristine, host.image_len);
 
   /*
    * Lock memory to prevent secrets in the flash buffer (seed, FVK, PIN
-   * derivation state) from being swapped out. Failure is non-fatal — many
+   * derivation state), in our rings/frame capture and in the handle's
+   * firmware state from being swapped out. Failure is non-fatal — many
    * platforms cap unprivileged mlock at a few MB (RLIMIT_MEMLOCK), and a
-   * dev/CI environment that hits the cap shouldn't break emulator usage.
-   * We DO log to stderr so the host can decide to escalate (raise the
-   * rlimit, run with CAP_IPC_LOCK, etc.) before signing real material.
-   * Production hosts of libkkemu should treat a logged failure as a
-   * security warning and refuse to load secrets.
+   * dev/CI environment that hits the cap shouldn't break emulator usage. We
+   * DO log to stderr so the host can decide to escalate (raise the rlimit,
+   * run with CAP_IPC_LOCK, etc.) before signing real material. Production
+   * hosts of libkkemu should treat a logged failure as a security warning
+   * and refuse to load secrets.
    */
   if (mlock(flash_buf, flash_len) != 0) {
     fprintf(stderr,
@@ -157,17 +640,28 @@ int kkemu_init(uint8_t* flash_buf, size_t flash_len) {
             "swapped to disk; do not load production secrets\n",
             flash_len, strerror(errno));
   }
+  if (mlock(ctx, sizeof(*ctx)) != 0 ||
+      mlock(ctx->image, host.image_len) != 0) {
+    fprintf(stderr,
+            "[libkkemu] mlock(%zu bytes) failed: %s — I/O rings and "
+            "firmware state may be swapped to disk; do not load production "
+            "secrets\n",
+            sizeof(*ctx) + host.image_len, strerror(errno));
+  }
 
-  /* Initialize ring buffers (replaces UDP socket init) */
-  libkkemu_socketInit();
+  pthread_mutex_init(&ctx->wake_lock, NULL);
+  pthread_cond_init(&ctx->wake_cond, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &ctx->last_tick);
+  ctx->flash_buf = flash_buf;
 
-  /* Reset frame capture state */
-  frame_write_idx = 0;
-  frame_read_idx = 0;
-  last_packed_valid = 0;
+  libkkemu_switch(ctx);
 
-  /* Initialize /dev/urandom for RNG */
-  setup_urandom_only();
+  /* Point firmware's flash pointer at the host-provided buffer */
+  emulator_flash_base = flash_buf;
+  flash_clearDirty();
+
+  /* Initialize ring buffers (replaces UDP socket init) */
+  libkkemu_socketInit();
 
   /* Board init (timers, etc.) */
   kk_board_init();
@@ -186,76 +680,267 @@ int kkemu_init(uint8_t* flash_buf, size_t flash_len) {
   /* Draw initial home screen */
   layoutHomeForced();
 
-  libkkemu_initialized = 1;
-  return 0;
+  libkkemu_leave(ctx);
+  return ctx;
 }
 
-void kkemu_shutdown(void) {
-  if (!libkkemu_initialized) return;
+/* Tear ctx down, returning the sectors it wrote that the host hasn't cleared */
+static uint32_t libkkemu_destroy(kkemu_ctx* ctx) {
+  libkkemu_enter(ctx);
 
-  /* Flush any pending storage to the flash buffer */
+  /*
+   * Drop cached seed/PIN/passphrase so the next handle on this image starts
+   * from its flash only, then flush any pending storage to the flash
+   * buffer.
+   */
+  session_clear(true);
   storage_commit();
+  libkkemu_collect_dirty();
+
+  display_set_dump_callback(NULL);
+  clear_runnables();
+  emulator_flash_base = NULL;
+
+  /* Nothing of this handle's firmware state stays in memory */
+  libkkemu_load_firmware(host.pristine);
+  host.live = NULL;
+  ctx->closing = true;
+
+  libkkemu_leave(ctx);
 
   /*
-   * Zero every static buffer that could hold sensitive material before
-   * we tear down. In dylib mode this library lives inside a long-running
-   * host process — the static rings, frame ring, and packed-display
-   * scratch can outlive the emulator session and be visible to the rest
-   * of the host's memory image (core dumps, ptrace, GC roots in a Bun
-   * runtime, etc.). Specifically:
+   * Unlock + caller is responsible for zeroing the host-owned flash buffer
+   * after this returns. We explicitly DO NOT zero it here — the host may
+   * want to inspect / persist post-mortem state. Documented contract.
+   */
+  munlock(ctx->flash_buf, KKEMU_FLASH_SIZE);
+
+  pthread_cond_destroy(&ctx->wake_cond);
+  pthread_mutex_destroy(&ctx->wake_lock);
+
+  uint32_t dirty = ctx->flash_dirty;
+
+  /*
+   * Zero everything we own before we tear down. In dylib mode this library
+   * lives inside a long-running host process — our rings, frame stream and
+   * packed-display scratch can outlive the emulator session and be visible
+   * to the rest of the host's memory image (core dumps, ptrace, GC roots in
+   * a Bun runtime, etc.). Specifically:
    *
-   *   - rb_main_in / rb_main_out:  PIN, passphrase, signing inputs/outputs
-   *   - rb_debug_in / rb_debug_out: mnemonic + recovery state when
-   *                                 KK_DEBUG_LINK builds are loaded
-   *   - frame_ring / last_packed:  rendered OLED bytes for every screen,
+   *   - main_in / main_out:        PIN, passphrase, signing inputs/outputs
+   *   - debug_in / debug_out:      mnemonic + recovery state when
+   *                                KK_DEBUG_LINK builds are loaded
+   *   - frame_stream / *_packed:   rendered OLED bytes for every screen,
    *                                including PIN matrix, recovery words,
    *                                address confirms, signing summaries
+   *   - image:                     the firmware's storage shadow and session
+   *                                while another handle was live
    *
    * memzero() is the trezor-crypto helper that the compiler can't optimize
    * out. Same primitive used throughout the firmware to clear key material.
    */
-  memzero(&rb_main_in, sizeof(rb_main_in));
-  memzero(&rb_main_out, sizeof(rb_main_out));
-  memzero(&rb_debug_in, sizeof(rb_debug_in));
-  memzero(&rb_debug_out, sizeof(rb_debug_out));
-  memzero(frame_ring, sizeof(frame_ring));
-  memzero(last_packed, sizeof(last_packed));
-  memzero(display_packed_scratch, sizeof(display_packed_scratch));
-  last_packed_valid = 0;
-  frame_write_idx = 0;
-  frame_read_idx = 0;
+  memzero(ctx->image, host.image_len);
+  munlock(ctx->image, host.image_len);
+  free(ctx->image);
+  memzero(ctx, sizeof(*ctx));
+  munlock(ctx, sizeof(*ctx));
+  free(ctx);
 
-  /*
-   * Unlock + caller is responsible for zeroing the host-owned flash buffer
-   * after this returns. We explicitly DO NOT zero it here — the host may
-   * want to inspect / persist post-mortem state. Documented contract.
-   */
-  if (emulator_flash_base) {
-    munlock(emulator_flash_base, KKEMU_FLASH_SIZE);
-    emulator_flash_base = NULL;
-  }
+  return dirty;
+}
 
-  libkkemu_initialized = 0;
+void kkemu_destroy(kkemu_ctx* ctx) {
+  if (!ctx) return;
+  libkkemu_destroy(ctx);
 }
 
-int kkemu_write(const uint8_t* data, size_t len, int iface) {
-  if (!libkkemu_initialized) return -1;
+int kkemu_init(uint8_t* flash_buf, size_t flash_len) {
+  if (host.device) return -1;
+
+  host.device = kkemu_create(flash_buf, flash_len);
+  if (!host.device) return -1;
+
+  host.shutdown_dirty = 0;
+  return 0;
+}
+
+void kkemu_shutdown(void) {
+  if (!host.device) return;
+
+  host.shutdown_dirty = libkkemu_destroy(host.device);
+  host.device = NULL;
+}
+
+/* Wake a kkemu_ctx_poll_wait() sleeping on the polling thread */
+static void libkkemu_wake(kkemu_ctx* ctx) {
+  pthread_mutex_lock(&ctx->wake_lock);
+  pthread_cond_signal(&ctx->wake_cond);
+  pthread_mutex_unlock(&ctx->wake_lock);
+}
+
+/*
+ * Follow the framing of reports the host popped with kkemu_ctx_read(), so
+ * that kkemu_ctx_recv_message() can step over the rest of a frame begun
+ * that way.
+ */
+static void libkkemu_track_read(kkemu_ctx* ctx, int out,
+                                const uint8_t* reports, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t* report = reports + i * RINGBUF_SLOT_SIZE;
+    if (ctx->out_skip[out]) {
+      ctx->out_skip[out]--;
+    } else if (libkkemu_is_header(report)) {
+      uint32_t len = libkkemu_header_len(report);
+      ctx->out_skip[out] =
+          len > KKEMU_MESSAGE_MAX ? 0 : libkkemu_frame_reports(len) - 1;
+    }
+  }
+}
+
+int kkemu_ctx_write(kkemu_ctx* ctx, const uint8_t* data, size_t len,
+                    int iface) {
+  if (!ctx) return -1;
   if (len != KKEMU_PACKET_SIZE) return -1;
 
-  RingBuf* rb = (iface == KKEMU_IFACE_MAIN) ? &rb_main_in : &rb_debug_in;
-  return ringbuf_push(rb, data, len) ? 0 : -1;
+  RingBuf* rb = (iface == KKEMU_IFACE_MAIN) ? &ctx->main_in : &ctx->debug_in;
+  if (!ringbuf_push(rb, data, len)) return -1;
+
+  libkkemu_wake(ctx);
+  return 0;
 }
 
-int kkemu_read(uint8_t* buf, size_t len, int iface) {
-  if (!libkkemu_initialized) return 0;
+int kkemu_ctx_read(kkemu_ctx* ctx, uint8_t* buf, size_t len, int iface) {
+  if (!ctx) return 0;
   if (len < KKEMU_PACKET_SIZE) return 0;
 
-  RingBuf* rb = (iface == KKEMU_IFACE_MAIN) ? &rb_main_out : &rb_debug_out;
-  return ringbuf_pop(rb, buf, KKEMU_PACKET_SIZE) ? KKEMU_PACKET_SIZE : 0;
+  int out = iface == KKEMU_IFACE_MAIN ? 0 : 1;
+  RingBuf* rb = out == 0 ? &ctx->main_out : &ctx->debug_out;
+  if (!ringbuf_pop(rb, buf, KKEMU_PACKET_SIZE)) return 0;
+
+  libkkemu_track_read(ctx, out, buf, 1);
+  return KKEMU_PACKET_SIZE;
 }
 
-int kkemu_poll(void) {
-  if (!libkkemu_initialized) return -1;
+int kkemu_ctx_write_many(kkemu_ctx* ctx, const uint8_t* data, size_t count,
+                         int iface) {
+  if (!ctx || (count && !data)) return -1;
+
+  RingBuf* rb = (iface == KKEMU_IFACE_MAIN) ? &ctx->main_in : &ctx->debug_in;
+  size_t pushed = ringbuf_push_many(rb, data, count);
+  if (pushed) libkkemu_wake(ctx);
+  return (int)pushed;
+}
+
+int kkemu_ctx_read_many(kkemu_ctx* ctx, uint8_t* buf, size_t max_count,
+                        int iface) {
+  if (!ctx || (max_count && !buf)) return -1;
+
+  int out = iface == KKEMU_IFACE_MAIN ? 0 : 1;
+  RingBuf* rb = out == 0 ? &ctx->main_out : &ctx->debug_out;
+  size_t popped = ringbuf_pop_many(rb, buf, max_count);
+
+  libkkemu_track_read(ctx, out, buf, popped);
+  return (int)popped;
+}
+
+int kkemu_ctx_send_message(kkemu_ctx* ctx, int iface, uint16_t msg_id,
+                           const uint8_t* payload, size_t len) {
+  if (!ctx || (len && !payload)) return -1;
+  if (len > KKEMU_MESSAGE_MAX) return -1;
+
+  RingBuf* rb = (iface == KKEMU_IFACE_MAIN) ? &ctx->main_in : &ctx->debug_in;
+  size_t reports = libkkemu_frame_reports(len);
+
+  /* All or nothing: never leave a partial frame in the input ring */
+  if (reports > ringbuf_space(rb)) return -1;
+
+  size_t off = 0;
+  for (size_t i = 0; i < reports; i++) {
+    uint8_t* slot = ringbuf_write_slot(rb, i);
+    size_t hdr = FRAME_CONT_HEADER_LEN;
+
+    slot[0] = '?';
+    if (i == 0) {
+      slot[1] = '#';
+      slot[2] = '#';
+      slot[3] = (uint8_t)(msg_id >> 8);
+      slot[4] = (uint8_t)msg_id;
+      slot[5] = (uint8_t)(len >> 24);
+      slot[6] = (uint8_t)(len >> 16);
+      slot[7] = (uint8_t)(len >> 8);
+      slot[8] = (uint8_t)len;
+      hdr = FRAME_FIRST_HEADER_LEN;
+    }
+
+    size_t chunk = len - off;
+    if (chunk > RINGBUF_SLOT_SIZE - hdr) chunk = RINGBUF_SLOT_SIZE - hdr;
+    if (chunk) memcpy(slot + hdr, payload + off, chunk);
+    memset(slot + hdr + chunk, 0, RINGBUF_SLOT_SIZE - hdr - chunk);
+    off += chunk;
+  }
+
+  ringbuf_commit(rb, reports);
+  libkkemu_wake(ctx);
+  return 0;
+}
+
+int kkemu_ctx_recv_message(kkemu_ctx* ctx, int iface, uint16_t* msg_id,
+                           uint8_t* buf, size_t buf_len, size_t* msg_len) {
+  if (!ctx) return -1;
+
+  int out = iface == KKEMU_IFACE_MAIN ? 0 : 1;
+  RingBuf* rb = out == 0 ? &ctx->main_out : &ctx->debug_out;
+  size_t avail = ringbuf_count(rb);
+
+  /* Step over the rest of a frame the host began with kkemu_ctx_read() */
+  size_t skip = ctx->out_skip[out] < avail ? ctx->out_skip[out] : avail;
+  ringbuf_consume(rb, skip);
+  ctx->out_skip[out] -= skip;
+  avail -= skip;
+
+  /* At a frame boundary now; raw usb_tx() output can't start a message */
+  while (avail > 0 && !libkkemu_is_header(ringbuf_read_slot(rb, 0))) {
+    ringbuf_consume(rb, 1);
+    avail--;
+  }
+  if (avail == 0) return 0;
+
+  const uint8_t* first = ringbuf_read_slot(rb, 0);
+  uint16_t id = (uint16_t)((first[3] << 8) | first[4]);
+  uint32_t len = libkkemu_header_len(first);
+  if (msg_id) *msg_id = id;
+  if (msg_len) *msg_len = len;
+
+  /* Stands in for a message the firmware could not queue */
+  if (len > KKEMU_MESSAGE_MAX) {
+    ringbuf_consume(rb, 1);
+    return -2;
+  }
+
+  size_t reports = libkkemu_frame_reports(len);
+  if (avail < reports) return 0;
+
+  /* Leave it queued so the host can retry with a big enough buffer */
+  if (len > buf_len || (len && !buf)) return -1;
+
+  size_t off = 0;
+  for (size_t i = 0; i < reports; i++) {
+    const uint8_t* slot = ringbuf_read_slot(rb, i);
+    size_t hdr = i == 0 ? FRAME_FIRST_HEADER_LEN : FRAME_CONT_HEADER_LEN;
+    size_t chunk = len - off;
+    if (chunk > RINGBUF_SLOT_SIZE - hdr) chunk = RINGBUF_SLOT_SIZE - hdr;
+    memcpy(buf + off, slot + hdr, chunk);
+    off += chunk;
+  }
+  ringbuf_consume(rb, reports);
+
+  return 1;
+}
+
+int kkemu_ctx_poll(kkemu_ctx* ctx) {
+  if (!ctx || ctx->closing) return -1;
+
+  libkkemu_enter(ctx);
 
   /*
    * This is the same as exec() in main.cpp:
@@ -267,56 +952,304 @@ int kkemu_poll(void) {
    * replaced with libkkemu_socketRead() via the ring buffers.
    */
   usbPoll();
+  storage_flush();
+  libkkemu_collect_dirty();
   animate();
   display_refresh();
 
+  libkkemu_leave(ctx);
   return 0;
 }
 
-const uint8_t* kkemu_get_display(int* width, int* height) {
+static bool libkkemu_input_pending(kkemu_ctx* ctx) {
+  return !ringbuf_empty(&ctx->main_in) || !ringbuf_empty(&ctx->debug_in);
+}
+
+/*
+ * There is no SIGALRM tick in the library build, so catch the firmware's
+ * 1 ms timer up to host time whenever we are about to do work. This is what
+ * makes runnables (animation frames, the confirm hold timeout) fire. A
+ * handle's timer stands still while it isn't live and catches up here.
+ */
+static void libkkemu_advance_timer(kkemu_ctx* ctx) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t elapsed_ms = (now.tv_sec - ctx->last_tick.tv_sec) * 1000 +
+                       (now.tv_nsec - ctx->last_tick.tv_nsec) / 1000000;
+  if (elapsed_ms <= 0) return;
+
+  timer_advance_ms((uint32_t)elapsed_ms);
+
+  /* Carry the sub-millisecond remainder so time doesn't drift */
+  ctx->last_tick.tv_sec += elapsed_ms / 1000;
+  ctx->last_tick.tv_nsec += (elapsed_ms % 1000) * 1000000;
+  if (ctx->last_tick.tv_nsec >= 1000000000) {
+    ctx->last_tick.tv_sec++;
+    ctx->last_tick.tv_nsec -= 1000000000;
+  }
+}
+
+int kkemu_ctx_poll_wait(kkemu_ctx* ctx, int timeout_ms,
+                        int* next_deadline_ms) {
+  if (!ctx || ctx->closing) return -1;
+
+  libkkemu_enter(ctx);
+  libkkemu_advance_timer(ctx);
+  uint32_t deadline = timer_next_deadline_ms();
+  libkkemu_leave(ctx);
+
+  /* Sleep for the shorter of the host's timeout and the next runnable */
+  uint32_t wait_ms = timeout_ms < 0 ? UINT32_MAX : (uint32_t)timeout_ms;
+  if (deadline < wait_ms) wait_ms = deadline;
+
+  /* Other handles run their firmware while this one sleeps */
+  if (wait_ms > 0 && !libkkemu_input_pending(ctx)) {
+    pthread_mutex_lock(&ctx->wake_lock);
+    if (wait_ms == UINT32_MAX) {
+      while (!libkkemu_input_pending(ctx)) {
+        pthread_cond_wait(&ctx->wake_cond, &ctx->wake_lock);
+      }
+    } else {
+      /* pthread_condattr_setclock() isn't available everywhere (macOS) */
+      struct timespec abstime;
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      abstime.tv_sec += wait_ms / 1000;
+      abstime.tv_nsec += (long)(wait_ms % 1000) * 1000000;
+      if (abstime.tv_nsec >= 1000000000) {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000;
+      }
+      while (!libkkemu_input_pending(ctx)) {
+        if (pthread_cond_timedwait(&ctx->wake_cond, &ctx->wake_lock,
+                                   &abstime) == ETIMEDOUT) {
+          break;
+        }
+      }
+    }
+    pthread_mutex_unlock(&ctx->wake_lock);
+  }
+
+  libkkemu_enter(ctx);
+  libkkemu_advance_timer(ctx);
+
+  /*
+   * usbPoll() consumes one report per call. Drain everything that is
+   * queued so a multi-report message is dispatched in this call rather
+   * than one report per host poll. Bounded so a host writing faster than
+   * we dispatch can't keep us here forever.
+   */
+  int worked = 0;
+  for (int i = 0;
+       i < 2 * RINGBUF_CAPACITY && libkkemu_input_pending(ctx); i++) {
+    usbPoll();
+    worked = 1;
+  }
+  storage_flush();
+  libkkemu_collect_dirty();
+  animate();
+  display_refresh();
+
+  deadline = timer_next_deadline_ms();
+  libkkemu_leave(ctx);
+
+  if (next_deadline_ms) {
+    *next_deadline_ms = deadline > INT32_MAX ? -1 : (int)deadline;
+  }
+
+  return worked;
+}
+
+const uint8_t* kkemu_ctx_get_display(kkemu_ctx* ctx, int* width,
+                                     int* height) {
   /*
    * Pack the firmware's 8-bpp grayscale canvas (256×64 = 16384 bytes) into
    * the 1-bit packed layout vault expects (2048 bytes). Same format
    * DebugLinkGetState.layout uses: byte index = x + (y/8)*256,
    * bit within byte = y%8 (LSB = top row of the 8-pixel column).
    *
-   * Output goes into the file-scope `display_packed_scratch` so
-   * kkemu_shutdown() can zero it on teardown alongside the frame ring.
+   * Output goes into `ctx->display_packed_scratch` so kkemu_destroy()
+   * zeroes it on teardown alongside the frame stream.
    */
-  if (!libkkemu_initialized) {
-    if (width) *width = 0;
-    if (height) *height = 0;
-    return NULL;
-  }
+  if (width) *width = 0;
+  if (height) *height = 0;
+  if (!ctx || ctx->closing) return NULL;
 
+  libkkemu_enter(ctx);
   const Canvas* c = display_canvas();
-  if (!c || !c->buffer) {
-    if (width) *width = 0;
-    if (height) *height = 0;
-    return NULL;
-  }
-
-  memset(display_packed_scratch, 0, sizeof(display_packed_scratch));
-  for (int x = 0; x < 256; x++) {
-    for (int y = 0; y < 64; y++) {
-      if (c->buffer[y * 256 + x] > 0) {
-        display_packed_scratch[x + (y / 8) * 256] |= (uint8_t)(1u << (y % 8));
-      }
-    }
+  bool drawn = c && c->buffer;
+  if (drawn) {
+    canvas_pack_mono(c->buffer, 256, 0, 256, 0, 64 / 8,
+                     ctx->display_packed_scratch);
   }
+  libkkemu_leave(ctx);
 
+  if (!drawn) return NULL;
   if (width) *width = 256;
   if (height) *height = 64;
-  return display_packed_scratch;
+  return ctx->display_packed_scratch;
 }
 
-int kkemu_pop_frame(uint8_t* out_packed) {
-  if (!libkkemu_initialized || !out_packed) return 0;
-  if (frame_read_idx == frame_write_idx) return 0;
-  const uint8_t* slot = frame_ring[frame_read_idx % FRAME_RING_SIZE];
-  memcpy(out_packed, slot, FRAME_PACKED_SIZE);
-  frame_read_idx++;
+int kkemu_ctx_pop_frame_rle(kkemu_ctx* ctx, uint8_t* out, size_t out_len,
+                            int* kind) {
+  if (!ctx || !out) return 0;
+  if (ctx->stream_records == 0) return 0;
+
+  uint8_t hdr[FRAME_RECORD_HEADER_LEN];
+  libkkemu_stream_get(ctx, ctx->stream_tail, hdr, sizeof(hdr));
+  size_t len = hdr[1] | (size_t)hdr[2] << 8;
+  if (out_len < len) return -1;
+
+  libkkemu_stream_get(ctx, ctx->stream_tail + FRAME_RECORD_HEADER_LEN, out,
+                      len);
+  ctx->stream_tail += FRAME_RECORD_HEADER_LEN + len;
+  ctx->stream_records--;
+
+  /* Keep the decoded view in step for kkemu_ctx_pop_frame() */
+  frame_rle_apply(ctx->host_frame, out, len, hdr[0] == KKEMU_FRAME_DELTA);
+
+  if (kind) *kind = hdr[0];
+  return (int)len;
+}
+
+int kkemu_ctx_pop_frame(kkemu_ctx* ctx, uint8_t* out_packed) {
+  if (!ctx || !out_packed) return 0;
+
+  if (kkemu_ctx_pop_frame_rle(ctx, ctx->rle_scratch, sizeof(ctx->rle_scratch),
+                              NULL) <= 0) {
+    return 0;
+  }
+
+  memcpy(out_packed, ctx->host_frame, FRAME_PACKED_SIZE);
   return 1;
 }
 
-int kkemu_is_running(void) { return libkkemu_initialized; }
+int kkemu_frame_apply(uint8_t* frame, const uint8_t* rec, size_t len,
+                      int kind) {
+  if (!frame || !rec) return -1;
+  if (kind != KKEMU_FRAME_KEY && kind != KKEMU_FRAME_DELTA) return -1;
+
+  return frame_rle_apply(frame, rec, len, kind == KKEMU_FRAME_DELTA) ? 0 : -1;
+}
+
+uint32_t kkemu_ctx_frames_dropped(kkemu_ctx* ctx) {
+  return ctx ? ctx->frames_dropped : 0;
+}
+
+int kkemu_ctx_get_dirty_ranges(kkemu_ctx* ctx, kkemu_flash_range* ranges,
+                               size_t max_ranges) {
+  if (!ctx) return -1;
+  if (ctx->closing) {
+    return libkkemu_dirty_ranges(ctx->flash_dirty, ranges, max_ranges);
+  }
+
+  /* Include sectors written by the firmware that no poll has collected */
+  libkkemu_enter(ctx);
+  uint32_t dirty = ctx->flash_dirty | flash_getDirty();
+  libkkemu_leave(ctx);
+
+  return libkkemu_dirty_ranges(dirty, ranges, max_ranges);
+}
+
+void kkemu_ctx_clear_dirty(kkemu_ctx* ctx) {
+  if (!ctx) return;
+  if (ctx->closing) {
+    ctx->flash_dirty = 0;
+    return;
+  }
+
+  libkkemu_enter(ctx);
+  ctx->flash_dirty = 0;
+  flash_clearDirty();
+  libkkemu_leave(ctx);
+}
+
+void kkemu_ctx_set_commit_callback(kkemu_ctx* ctx, kkemu_commit_cb cb,
+                                   void* user) {
+  if (!ctx) return;
+  ctx->commit_cb = cb;
+  ctx->commit_user = user;
+}
+
+uint32_t kkemu_ctx_set_ethereum_chunking(kkemu_ctx* ctx, uint32_t chunk_size,
+                                         int stream) {
+  if (!ctx || ctx->closing) return 0;
+
+  libkkemu_enter(ctx);
+  uint32_t size = ethereum_setDataChunking(chunk_size, stream != 0);
+  libkkemu_leave(ctx);
+  return size;
+}
+
+/* ── Single-device API ─────────────────────────────────────────────── */
+
+int kkemu_write(const uint8_t* data, size_t len, int iface) {
+  return kkemu_ctx_write(host.device, data, len, iface);
+}
+
+int kkemu_read(uint8_t* buf, size_t len, int iface) {
+  return kkemu_ctx_read(host.device, buf, len, iface);
+}
+
+int kkemu_write_many(const uint8_t* data, size_t count, int iface) {
+  return kkemu_ctx_write_many(host.device, data, count, iface);
+}
+
+int kkemu_read_many(uint8_t* buf, size_t max_count, int iface) {
+  return kkemu_ctx_read_many(host.device, buf, max_count, iface);
+}
+
+int kkemu_send_message(int iface, uint16_t msg_id, const uint8_t* payload,
+                       size_t len) {
+  return kkemu_ctx_send_message(host.device, iface, msg_id, payload, len);
+}
+
+int kkemu_recv_message(int iface, uint16_t* msg_id, uint8_t* buf,
+                       size_t buf_len, size_t* msg_len) {
+  return kkemu_ctx_recv_message(host.device, iface, msg_id, buf, buf_len,
+                                msg_len);
+}
+
+int kkemu_poll(void) { return kkemu_ctx_poll(host.device); }
+
+int kkemu_poll_wait(int timeout_ms, int* next_deadline_ms) {
+  return kkemu_ctx_poll_wait(host.device, timeout_ms, next_deadline_ms);
+}
+
+const uint8_t* kkemu_get_display(int* width, int* height) {
+  return kkemu_ctx_get_display(host.device, width, height);
+}
+
+int kkemu_pop_frame_rle(uint8_t* out, size_t out_len, int* kind) {
+  return kkemu_ctx_pop_frame_rle(host.device, out, out_len, kind);
+}
+
+int kkemu_pop_frame(uint8_t* out_packed) {
+  return kkemu_ctx_pop_frame(host.device, out_packed);
+}
+
+uint32_t kkemu_frames_dropped(void) {
+  return kkemu_ctx_frames_dropped(host.device);
+}
+
+int kkemu_get_dirty_ranges(kkemu_flash_range* ranges, size_t max_ranges) {
+  if (!host.device) {
+    return libkkemu_dirty_ranges(host.shutdown_dirty, ranges, max_ranges);
+  }
+  return kkemu_ctx_get_dirty_ranges(host.device, ranges, max_ranges);
+}
+
+void kkemu_clear_dirty(void) {
+  host.shutdown_dirty = 0;
+  kkemu_ctx_clear_dirty(host.device);
+}
+
+void kkemu_set_commit_callback(kkemu_commit_cb cb, void* user) {
+  kkemu_ctx_set_commit_callback(host.device, cb, user);
+}
+
+uint32_t kkemu_set_ethereum_chunking(uint32_t chunk_size, int stream) {
+  return kkemu_ctx_set_ethereum_chunking(host.device, chunk_size, stream);
+}
+
+int kkemu_is_running(void) { return host.device != NULL; }
@@ -48,3 +48,80 @@ bool ringbuf_empty(RingBuf* rb) {
   uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
   return head == tail;
 }
+
+size_t ringbuf_push_many(RingBuf* rb, const uint8_t* msgs, size_t count) {
+  uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+  size_t space = (tail + RINGBUF_CAPACITY - head - 1) % RINGBUF_CAPACITY;
+
+  if (count > space) count = space;
+  if (count == 0) return 0;
+
+  /* At most two contiguous runs: up to the end of the array, then from 0 */
+  size_t first = RINGBUF_CAPACITY - head;
+  if (first > count) first = count;
+  memcpy(rb->data[head], msgs, first * RINGBUF_SLOT_SIZE);
+  if (count > first) {
+    memcpy(rb->data[0], msgs + first * RINGBUF_SLOT_SIZE,
+           (count - first) * RINGBUF_SLOT_SIZE);
+  }
+
+  atomic_store_explicit(&rb->head, (head + count) % RINGBUF_CAPACITY,
+                        memory_order_release);
+  return count;
+}
+
+size_t ringbuf_pop_many(RingBuf* rb, uint8_t* msgs, size_t count) {
+  uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+  size_t avail = (head + RINGBUF_CAPACITY - tail) % RINGBUF_CAPACITY;
+
+  if (count > avail) count = avail;
+  if (count == 0) return 0;
+
+  size_t first = RINGBUF_CAPACITY - tail;
+  if (first > count) first = count;
+  memcpy(msgs, rb->data[tail], first * RINGBUF_SLOT_SIZE);
+  if (count > first) {
+    memcpy(msgs + first * RINGBUF_SLOT_SIZE, rb->data[0],
+           (count - first) * RINGBUF_SLOT_SIZE);
+  }
+
+  atomic_store_explicit(&rb->tail, (tail + count) % RINGBUF_CAPACITY,
+                        memory_order_release);
+  return count;
+}
+
+size_t ringbuf_space(RingBuf* rb) {
+  uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+  return (tail + RINGBUF_CAPACITY - head - 1) % RINGBUF_CAPACITY;
+}
+
+uint8_t* ringbuf_write_slot(RingBuf* rb, size_t idx) {
+  uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+  return rb->data[(head + idx) % RINGBUF_CAPACITY];
+}
+
+void ringbuf_commit(RingBuf* rb, size_t count) {
+  uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+  atomic_store_explicit(&rb->head, (head + count) % RINGBUF_CAPACITY,
+                        memory_order_release);
+}
+
+size_t ringbuf_count(RingBuf* rb) {
+  uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+  return (head + RINGBUF_CAPACITY - tail) % RINGBUF_CAPACITY;
+}
+
+const uint8_t* ringbuf_read_slot(RingBuf* rb, size_t idx) {
+  uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+  return rb->data[(tail + idx) % RINGBUF_CAPACITY];
+}
+
+void ringbuf_consume(RingBuf* rb, size_t count) {
+  uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+  atomic_store_explicit(&rb->tail, (tail + count) % RINGBUF_CAPACITY,
+                        memory_order_release);
+}
@@ -8,11 +8,20 @@
 #ifndef RINGBUF_H
 #define RINGBUF_H
 
-#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+/* C++ code (the unit tests) only hands RingBufs to the functions below */
+#include <atomic>
+typedef std::atomic<uint32_t> ringbuf_index_t;
+extern "C" {
+#else
+#include <stdatomic.h>
+typedef _Atomic uint32_t ringbuf_index_t;
+#endif
+
 #define RINGBUF_SLOT_SIZE 64 /* HID report size */
 
 /*
@@ -35,8 +44,8 @@
 
 typedef struct {
   uint8_t data[RINGBUF_CAPACITY][RINGBUF_SLOT_SIZE];
-  _Atomic uint32_t head; /* written by producer */
-  _Atomic uint32_t tail; /* written by consumer */
+  ringbuf_index_t head; /* written by producer */
+  ringbuf_index_t tail; /* written by consumer */
 } RingBuf;
 
 void ringbuf_init(RingBuf* rb);
@@ -44,4 +53,29 @@ bool ringbuf_push(RingBuf* rb, const uint8_t* msg, size_t len);
 bool ringbuf_pop(RingBuf* rb, uint8_t* msg, size_t len);
 bool ringbuf_empty(RingBuf* rb);
 
+/*
+ * Batched variants. `msgs` is `count` contiguous RINGBUF_SLOT_SIZE slots.
+ * Each call does a single acquire of the other side's index and a single
+ * release of its own, and returns the number of slots actually moved.
+ */
+size_t ringbuf_push_many(RingBuf* rb, const uint8_t* msgs, size_t count);
+size_t ringbuf_pop_many(RingBuf* rb, uint8_t* msgs, size_t count);
+
+/*
+ * Zero-copy access. The producer fills ringbuf_write_slot(rb, 0..n-1) for
+ * n <= ringbuf_space(rb) and publishes them with ringbuf_commit(rb, n). The
+ * consumer reads ringbuf_read_slot(rb, 0..n-1) for n <= ringbuf_count(rb)
+ * and releases them with ringbuf_consume(rb, n).
+ */
+size_t ringbuf_space(RingBuf* rb);
+uint8_t* ringbuf_write_slot(RingBuf* rb, size_t idx);
+void ringbuf_commit(RingBuf* rb, size_t count);
+size_t ringbuf_count(RingBuf* rb);
+const uint8_t* ringbuf_read_slot(RingBuf* rb, size_t idx);
+void ringbuf_consume(RingBuf* rb, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -55,6 +55,7 @@ void emulatorRandom(void* buffer, size_t size) {
 }
 
 static void setup_urandom(void) {
+  if (urandom >= 0) return;
   urandom = open("/dev/urandom", O_RDONLY);
   if (urandom < 0) {
     perror("Failed to open /dev/urandom");
@@ -17,26 +17,63 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* recvmmsg / sendmmsg */
+#endif
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #ifndef KEEPKEY_UDP_PORT
 #define KEEPKEY_UDP_PORT 11044
 #endif
 
+/* Reports moved per recvmmsg() / sendmmsg() call */
+#define SOCKET_BATCH 64
+#define SOCKET_REPORT_SIZE 64
+
 struct usb_socket {
   int fd;
   struct sockaddr_in from;
   socklen_t fromlen;
+
+  /* Reports received by the last batched read, not yet handed out */
+  uint8_t in[SOCKET_BATCH][SOCKET_REPORT_SIZE];
+  size_t in_len[SOCKET_BATCH];
+  size_t in_head, in_count;
+
+  /* Reports queued for the next batched write */
+  uint8_t out[SOCKET_BATCH][SOCKET_REPORT_SIZE];
+  size_t out_len[SOCKET_BATCH];
+  size_t out_count;
 };
 
 static struct usb_socket usb_main;
 static struct usb_socket usb_debug;
 
+#ifdef __linux__
+static int epoll_fd = -1;
+#endif
+
+static int socket_port(const struct usb_socket* sock) {
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(sock->fd, (struct sockaddr*)&addr, &addrlen) != 0) {
+    return 0;
+  }
+  return ntohs(addr.sin_port);
+}
+
 static int socket_setup(int port) {
   int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
   if (fd < 0) {
@@ -58,41 +95,145 @@ static int socket_setup(int port) {
   return fd;
 }
 
+static void socket_flush(struct usb_socket* sock) {
+  if (!sock->out_count) return;
+
+  if (sock->fromlen > 0) {
+#ifdef __linux__
+    struct mmsghdr msgs[SOCKET_BATCH];
+    struct iovec iovs[SOCKET_BATCH];
+    memset(msgs, 0, sizeof(msgs[0]) * sock->out_count);
+    for (size_t i = 0; i < sock->out_count; i++) {
+      iovs[i].iov_base = sock->out[i];
+      iovs[i].iov_len = sock->out_len[i];
+      msgs[i].msg_hdr.msg_name = &sock->from;
+      msgs[i].msg_hdr.msg_namelen = sock->fromlen;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    size_t sent = 0;
+    while (sent < sock->out_count) {
+      int n = sendmmsg(sock->fd, &msgs[sent], sock->out_count - sent, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        perror("Failed to write socket");
+        break;
+      }
+      sent += n;
+    }
+#else
+    for (size_t i = 0; i < sock->out_count; i++) {
+      ssize_t n = sendto(sock->fd, sock->out[i], sock->out_len[i], 0,
+                         (const struct sockaddr*)&sock->from, sock->fromlen);
+      if (n < 0 || ((size_t)n) != sock->out_len[i]) {
+        perror("Failed to write socket");
+        break;
+      }
+    }
+#endif
+  }
+
+  sock->out_count = 0;
+}
+
 static size_t socket_write(struct usb_socket* sock, const void* buffer,
                            size_t size) {
   if (sock->fromlen > 0) {
-    ssize_t n = sendto(sock->fd, buffer, size, MSG_DONTWAIT,
-                       (const struct sockaddr*)&sock->from, sock->fromlen);
-    if (n < 0 || ((size_t)n) != size) {
-      perror("Failed to write socket");
-      return 0;
-    }
+    if (size > SOCKET_REPORT_SIZE) size = SOCKET_REPORT_SIZE;
+    if (sock->out_count == SOCKET_BATCH) socket_flush(sock);
+    memcpy(sock->out[sock->out_count], buffer, size);
+    sock->out_len[sock->out_count] = size;
+    sock->out_count++;
   }
 
   return size;
 }
 
-static size_t socket_read(struct usb_socket* sock, void* buffer, size_t size) {
-  sock->fromlen = sizeof(sock->from);
-  ssize_t n = recvfrom(sock->fd, buffer, size, MSG_DONTWAIT,
-                       (struct sockaddr*)&sock->from, &sock->fromlen);
+/* Pull every pending datagram (up to a batch) into the input queue */
+static void socket_fill(struct usb_socket* sock) {
+  static const char msg_ping[] = {'P', 'I', 'N', 'G', 'P', 'I', 'N', 'G'};
+  static const char msg_pong[] = {'P', 'O', 'N', 'G', 'P', 'O', 'N', 'G'};
 
+  struct sockaddr_in from[SOCKET_BATCH];
+  socklen_t fromlen[SOCKET_BATCH];
+  int n = 0;
+
+#ifdef __linux__
+  struct mmsghdr msgs[SOCKET_BATCH];
+  struct iovec iovs[SOCKET_BATCH];
+  memset(msgs, 0, sizeof(msgs));
+  for (int i = 0; i < SOCKET_BATCH; i++) {
+    iovs[i].iov_base = sock->in[i];
+    iovs[i].iov_len = SOCKET_REPORT_SIZE;
+    msgs[i].msg_hdr.msg_name = &from[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  n = recvmmsg(sock->fd, msgs, SOCKET_BATCH, MSG_DONTWAIT, NULL);
   if (n < 0) {
-    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
       perror("Failed to read socket");
     }
-    return 0;
+    return;
   }
 
-  static const char msg_ping[] = {'P', 'I', 'N', 'G', 'P', 'I', 'N', 'G'};
-  static const char msg_pong[] = {'P', 'O', 'N', 'G', 'P', 'O', 'N', 'G'};
+  for (int i = 0; i < n; i++) {
+    sock->in_len[i] = msgs[i].msg_len;
+    fromlen[i] = msgs[i].msg_hdr.msg_namelen;
+  }
+#else
+  for (; n < SOCKET_BATCH; n++) {
+    fromlen[n] = sizeof(from[n]);
+    ssize_t len = recvfrom(sock->fd, sock->in[n], SOCKET_REPORT_SIZE,
+                           MSG_DONTWAIT, (struct sockaddr*)&from[n],
+                           &fromlen[n]);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("Failed to read socket");
+      }
+      break;
+    }
+    sock->in_len[n] = len;
+  }
+#endif
 
-  if (n == sizeof(msg_ping) &&
-      memcmp(buffer, msg_ping, sizeof(msg_ping)) == 0) {
-    socket_write(sock, msg_pong, sizeof(msg_pong));
-    return 0;
+  sock->in_head = 0;
+  sock->in_count = 0;
+  for (int i = 0; i < n; i++) {
+    /* Replies go to whoever sent last */
+    sock->from = from[i];
+    sock->fromlen = fromlen[i];
+
+    if (sock->in_len[i] == sizeof(msg_ping) &&
+        memcmp(sock->in[i], msg_ping, sizeof(msg_ping)) == 0) {
+      socket_write(sock, msg_pong, sizeof(msg_pong));
+      continue;
+    }
+
+    if (sock->in_count != (size_t)i) {
+      memcpy(sock->in[sock->in_count], sock->in[i], sock->in_len[i]);
+      sock->in_len[sock->in_count] = sock->in_len[i];
+    }
+    sock->in_count++;
   }
 
+  /* Answer pings right away */
+  socket_flush(sock);
+}
+
+static size_t socket_read(struct usb_socket* sock, void* buffer, size_t size) {
+  if (!sock->in_count) socket_fill(sock);
+  if (!sock->in_count) return 0;
+
+  size_t n = sock->in_len[sock->in_head];
+  if (n > size) n = size;
+  memcpy(buffer, sock->in[sock->in_head], n);
+  sock->in_head++;
+  sock->in_count--;
+
   return n;
 }
 
@@ -115,6 +256,18 @@ size_t emulatorSocketWrite(int iface, const void* buffer, size_t size) {
   return libkkemu_socketWrite(iface, buffer, size);
 }
 
+int emulatorSocketPort(int iface) {
+  (void)iface;
+  return 0;
+}
+
+void emulatorSocketFlush(void) {}
+
+int emulatorSocketWait(int timeout_ms) {
+  (void)timeout_ms;
+  return 0;
+}
+
 #else
 /* Standard mode: UDP sockets (standalone kkemu binary) */
 
@@ -122,15 +275,34 @@ void emulatorSocketInit(void) {
   int port = KEEPKEY_UDP_PORT;
   const char* env_port = getenv("KEEPKEY_UDP_PORT");
   if (env_port) {
-    int p = atoi(env_port);
-    if (p > 0 && p < 65535) port = p;
+    char* end;
+    long p = strtol(env_port, &end, 10);
+    if (end != env_port && *end == '\0' && p >= 0 && p < 65535) port = p;
   }
-  fprintf(stderr, "Emulator listening on UDP ports %d (main) and %d (debug)\n",
-          port, port + 1);
+
+  /* Port 0 lets the kernel pick a free port for each interface */
   usb_main.fd = socket_setup(port);
   usb_main.fromlen = 0;
-  usb_debug.fd = socket_setup(port + 1);
+  usb_debug.fd = socket_setup(port ? port + 1 : 0);
   usb_debug.fromlen = 0;
+  fprintf(stderr, "Emulator listening on UDP ports %d (main) and %d (debug)\n",
+          socket_port(&usb_main), socket_port(&usb_debug));
+
+#ifdef __linux__
+  epoll_fd = epoll_create1(0);
+  if (epoll_fd < 0) {
+    perror("Failed to create epoll instance");
+    exit(1);
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = &usb_main;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usb_main.fd, &ev);
+  ev.data.ptr = &usb_debug;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usb_debug.fd, &ev);
+#endif
 }
 
 size_t emulatorSocketRead(int* iface, void* buffer, size_t size) {
@@ -149,6 +321,12 @@ size_t emulatorSocketRead(int* iface, void* buffer, size_t size) {
   return 0;
 }
 
+int emulatorSocketPort(int iface) {
+  if (iface == 0) return socket_port(&usb_main);
+  if (iface == 1) return socket_port(&usb_debug);
+  return 0;
+}
+
 size_t emulatorSocketWrite(int iface, const void* buffer, size_t size) {
   if (iface == 0) {
     return socket_write(&usb_main, buffer, size);
@@ -158,4 +336,25 @@ size_t emulatorSocketWrite(int iface, const void* buffer, size_t size) {
   }
   return 0;
 }
+void emulatorSocketFlush(void) {
+  socket_flush(&usb_main);
+  socket_flush(&usb_debug);
+}
+
+int emulatorSocketWait(int timeout_ms) {
+  if (usb_main.in_count || usb_debug.in_count) return 1;
+
+  emulatorSocketFlush();
+
+#ifdef __linux__
+  struct epoll_event events[2];
+  int n = epoll_wait(epoll_fd, events, 2, timeout_ms);
+#else
+  struct pollfd fds[2] = {{usb_main.fd, POLLIN, 0}, {usb_debug.fd, POLLIN, 0}};
+  int n = poll(fds, 2, timeout_ms);
+#endif
+
+  /* EINTR (the timer tick) just means nothing arrived yet */
+  return n > 0;
+}
 #endif
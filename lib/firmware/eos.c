@@ -221,7 +221,7 @@ bool eos_derivePublicKey(const uint32_t* addr_n, size_t addr_n_count,
   if (!eos_signingIsInited()) return false;
 
   memcpy(&node, &root, sizeof(node));
-  if (hdnode_private_ckd_cached(&node, addr_n, addr_n_count, NULL) == 0) {
+  if (session_deriveNode(&node, addr_n, addr_n_count, NULL) == 0) {
     fsm_sendFailure(FailureType_Failure_Other, "Child key derivation failed");
     eos_signingAbort();
     return false;
@@ -552,7 +552,7 @@ bool eos_signTx(EosSignedTx* tx) {
   hasher_Final(&hasher_preimage, tx->hash.bytes);
 
   memcpy(&node, &root, sizeof(node));
-  if (hdnode_private_ckd_cached(&node, address_n, address_n_count, NULL) == 0) {
+  if (session_deriveNode(&node, address_n, address_n_count, NULL) == 0) {
     fsm_sendFailure(FailureType_Failure_Other, "Child key derivation failed");
     eos_signingAbort();
     return false;
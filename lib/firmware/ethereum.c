@@ -56,6 +56,8 @@
 
 static bool ethereum_signing = false;
 static uint32_t data_total, data_left;
+static uint32_t data_chunk_size = ETHEREUM_DATA_CHUNK_SIZE;
+static bool data_chunk_stream, data_chunk_requested;
 static EthereumTxRequest msg_tx_request;
 static CONFIDENTIAL uint8_t privkey[32];
 static uint32_t chain_id;
@@ -122,6 +124,49 @@ static inline void hash_data(const uint8_t* buf, size_t size) {
   sha3_Update(&keccak_ctx, buf, size);
 }
 
+/* EthereumTxAck.data_chunk is hashed straight out of the USB fragments as it
+ * arrives (see ethereum_txack_stream), so it never has to fit in the decode
+ * buffer. ethereum_signing_txack() then only checks what was streamed. */
+static uint32_t chunk_streamed;
+static bool chunk_too_big;
+
+static void ethereum_txack_stream_begin(void) {
+  chunk_streamed = 0;
+  chunk_too_big = false;
+}
+
+static bool ethereum_txack_stream_data(const uint8_t* buf, size_t len,
+                                       uint32_t total) {
+  if (!ethereum_signing || chunk_too_big) {
+    return true;
+  }
+
+  // Reject oversized chunks before any of them reaches the hash.
+  if (chunk_streamed == 0 && total > data_left) {
+    chunk_too_big = true;
+    return true;
+  }
+
+  hash_data(buf, len);
+  chunk_streamed += len;
+  return true;
+}
+
+static void ethereum_txack_stream_abort(void) {
+  // A partially hashed chunk leaves keccak_ctx unusable.
+  if (chunk_streamed) {
+    ethereum_signing_abort();
+  }
+  chunk_streamed = 0;
+}
+
+const MessageStream ethereum_txack_stream = {
+    .tag = EthereumTxAck_data_chunk_tag,
+    .begin = ethereum_txack_stream_begin,
+    .data = ethereum_txack_stream_data,
+    .abort = ethereum_txack_stream_abort,
+};
+
 /*
  * Push an RLP encoded length to the hash buffer.
  */
@@ -239,11 +284,25 @@ static int rlp_calculate_number_length(uint32_t number) {
 
 static void send_request_chunk(void) {
   layoutProgress(_("Signing"), (data_total - data_left) * 1000 / data_total);
+
+  // A streaming host sends the rest of the data unasked.
+  if (data_chunk_stream && data_chunk_requested) return;
+  data_chunk_requested = true;
+
   msg_tx_request.has_data_length = true;
-  msg_tx_request.data_length = data_left <= 1024 ? data_left : 1024;
+  msg_tx_request.data_length = MIN(data_left, data_chunk_size);
   msg_write(MessageType_MessageType_EthereumTxRequest, &msg_tx_request);
 }
 
+#ifdef EMULATOR
+uint32_t ethereum_setDataChunking(uint32_t chunk_size, bool stream) {
+  data_chunk_size = MAX(ETHEREUM_DATA_CHUNK_SIZE,
+                        MIN(chunk_size, ETHEREUM_DATA_CHUNK_MAX));
+  data_chunk_stream = stream;
+  return data_chunk_size;
+}
+#endif
+
 static int ethereum_is_canonic(uint8_t v, uint8_t signature[64]) {
   (void)signature;
   return (v & 2) == 0;
@@ -598,6 +657,7 @@ void ethereum_signing_init(EthereumSignTx* msg, const HDNode* node,
   char confirm_body_message[121] = {0};
 
   ethereum_signing = true;
+  data_chunk_requested = false;
   sha3_256_Init(&keccak_ctx);
 
   memset(&msg_tx_request, 0, sizeof(EthereumTxRequest));
@@ -906,13 +966,19 @@ void ethereum_signing_txack(EthereumTxAck* tx) {
     return;
   }
 
-  if (tx->data_chunk.size > data_left) {
+  // The chunk was either streamed into the hash already, or (when not
+  // received over USB) decoded into the struct.
+  uint32_t chunk_size = chunk_streamed + tx->data_chunk.size;
+  chunk_streamed = 0;
+
+  if (chunk_too_big || chunk_size > data_left) {
+    chunk_too_big = false;
     fsm_sendFailure(FailureType_Failure_Other, _("Too much data"));
     ethereum_signing_abort();
     return;
   }
 
-  if (data_left > 0 && (!tx->has_data_chunk || tx->data_chunk.size == 0)) {
+  if (data_left > 0 && chunk_size == 0) {
     fsm_sendFailure(FailureType_Failure_Other, _("Empty data chunk received"));
     ethereum_signing_abort();
     return;
@@ -920,7 +986,7 @@ void ethereum_signing_txack(EthereumTxAck* tx) {
 
   hash_data(tx->data_chunk.bytes, tx->data_chunk.size);
 
-  data_left -= tx->data_chunk.size;
+  data_left -= chunk_size;
 
   if (data_left > 0) {
     send_request_chunk();
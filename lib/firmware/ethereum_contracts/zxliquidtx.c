@@ -55,8 +55,8 @@ static HDNode* zx_getDerivedNode(const char* curve, const uint32_t* address_n,
     return &node;
   }
 
-  if (hdnode_private_ckd_cached(&node, address_n, address_n_count,
-                                fingerprint) == 0) {
+  if (session_deriveNode(&node, address_n, address_n_count, fingerprint) ==
+      0) {
     return 0;
   }
 
@@ -143,6 +143,10 @@ static const MessagesMap_t MessagesMap[] = {
 #undef MSG_OUT
 #define MSG_OUT(ID, STRUCT_NAME, PROCESS_FUNC)
 
+#undef MSG_IN_STREAM
+#define MSG_IN_STREAM(ID, STRUCT_NAME, PROCESS_FUNC, STREAM) \
+  _Static_assert(sizeof(STRUCT_NAME) <= MAX_DECODE_SIZE, "Message too big");
+
 #undef RAW_IN
 #define RAW_IN(ID, STRUCT_NAME, PROCESS_FUNC) \
   _Static_assert(sizeof(STRUCT_NAME) <= MAX_DECODE_SIZE, "Message too big");
@@ -199,8 +203,8 @@ static HDNode* fsm_getDerivedNode(const char* curve, const uint32_t* address_n,
     return &node;
   }
 
-  if (hdnode_private_ckd_cached(&node, address_n, address_n_count,
-                                fingerprint) == 0) {
+  if (session_deriveNode(&node, address_n, address_n_count, fingerprint) ==
+      0) {
     fsm_sendFailure(FailureType_Failure_Other, "Failed to derive private key");
     layoutHome();
     return 0;
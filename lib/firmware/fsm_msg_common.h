@@ -637,7 +637,13 @@ void fsm_msgApplySettings(ApplySettings* msg) {
     storage_setU2FCounter(msg->u2f_counter);
   }
 
-  storage_commit();
+  // Passphrase protection and the U2F counter must not be lost to a reset
+  // right after the Success; label, language and auto-lock delay can wait.
+  if (msg->has_use_passphrase || msg->has_u2f_counter) {
+    storage_commit();
+  } else {
+    storage_commitDeferred();
+  }
 
   fsm_sendSuccess("Settings applied");
   layoutHome();
@@ -62,14 +62,7 @@ void fsm_msgDebugLinkGetState(DebugLinkGetState* msg) {
     if (c && c->buffer) {
       resp->has_layout = true;
       resp->layout.size = 2048;
-      memset(resp->layout.bytes, 0, 2048);
-      for (int x = 0; x < 256; x++) {
-        for (int y = 0; y < 64; y++) {
-          if (c->buffer[y * 256 + x] > 0) {
-            resp->layout.bytes[x + (y / 8) * 256] |= (1 << (y % 8));
-          }
-        }
-      }
+      canvas_pack_mono(c->buffer, 256, 0, 256, 0, 64 / 8, resp->layout.bytes);
     }
   }
 
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the KeepKey project.
+ *
+ * Copyright (C) 2026 KeepKey LLC
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keepkey/firmware/prevtx_cache.h"
+
+#include <string.h>
+
+#define PREVTX_PENDING 0xff
+
+typedef struct {
+  uint8_t tx;  // index into prevtx_ids, or PREVTX_PENDING
+  uint32_t index;
+  uint64_t amount;
+} PrevTxOutput;
+
+static uint8_t prevtx_ids[PREVTX_CACHE_TXIDS][32];
+static uint32_t prevtx_ids_count;
+static PrevTxOutput prevtx_outputs[PREVTX_CACHE_OUTPUTS];
+static uint32_t prevtx_outputs_count; /* committed, then pending */
+static uint32_t prevtx_committed;
+
+void prevtx_cache_init(void) {
+  prevtx_ids_count = 0;
+  prevtx_outputs_count = 0;
+  prevtx_committed = 0;
+}
+
+void prevtx_cache_add(uint32_t index, uint64_t amount) {
+  if (prevtx_outputs_count >= PREVTX_CACHE_OUTPUTS) return;
+  PrevTxOutput* entry = &prevtx_outputs[prevtx_outputs_count++];
+  entry->tx = PREVTX_PENDING;
+  entry->index = index;
+  entry->amount = amount;
+}
+
+static bool prevtx_cache_find(uint8_t tx, uint32_t index, uint64_t* amount) {
+  for (uint32_t i = 0; i < prevtx_committed; i++) {
+    const PrevTxOutput* out = &prevtx_outputs[i];
+    if (out->tx == tx && out->index == index) {
+      if (amount) *amount = out->amount;
+      return true;
+    }
+  }
+  return false;
+}
+
+void prevtx_cache_commit(const uint8_t txid[32]) {
+  uint32_t tx = 0;
+  while (tx < prevtx_ids_count && memcmp(prevtx_ids[tx], txid, 32) != 0) {
+    tx++;
+  }
+
+  if (tx == prevtx_ids_count) {
+    if (prevtx_ids_count >= PREVTX_CACHE_TXIDS) {
+      // No room for another txid: drop what it streamed
+      prevtx_outputs_count = prevtx_committed;
+      return;
+    }
+    memcpy(prevtx_ids[prevtx_ids_count++], txid, 32);
+  }
+
+  // Keep each output once, even when the same prevtx was streamed again
+  uint32_t pending_end = prevtx_outputs_count;
+  for (uint32_t i = prevtx_committed; i < pending_end; i++) {
+    if (prevtx_cache_find(tx, prevtx_outputs[i].index, NULL)) continue;
+    prevtx_outputs[prevtx_committed] = prevtx_outputs[i];
+    prevtx_outputs[prevtx_committed].tx = tx;
+    prevtx_committed++;
+  }
+  prevtx_outputs_count = prevtx_committed;
+}
+
+bool prevtx_cache_lookup(const uint8_t txid[32], uint32_t index,
+                         uint64_t* amount) {
+  for (uint32_t tx = 0; tx < prevtx_ids_count; tx++) {
+    if (memcmp(prevtx_ids[tx], txid, 32) == 0) {
+      return prevtx_cache_find(tx, index, amount);
+    }
+  }
+  return false;
+}
@@ -30,7 +30,9 @@
 #include "keepkey/firmware/fsm.h"
 #include "keepkey/firmware/home_sm.h"
 #include "keepkey/firmware/policy.h"
+#include "keepkey/firmware/prevtx_cache.h"
 #include "keepkey/firmware/signing.h"
+#include "keepkey/firmware/storage.h"
 #include "keepkey/firmware/txin_check.h"
 #include "keepkey/firmware/transaction.h"
 #include "trezor/crypto/ecdsa.h"
@@ -101,6 +103,13 @@ static uint8_t multisig_fp[32];
 static uint32_t in_address_n[8];
 static size_t in_address_n_count;
 static uint32_t tx_weight;
+static int update_ctr;
+
+/* Serialized outputs kept from phase 1, so that legacy inputs can be signed
+   without streaming every output again for each of them. */
+static uint8_t outputs_cache[TX_OUTPUTS_CACHE_SIZE];
+static uint32_t outputs_cache_len;
+static bool outputs_cache_valid;
 
 /* A marker for in_address_n_count to indicate a mismatch in bip32 paths in
    input */
@@ -588,8 +597,8 @@ bool compile_input_script_sig(TxInputType* tinput) {
     }
   }
   memcpy(&node, root, sizeof(HDNode));
-  if (hdnode_private_ckd_cached(&node, tinput->address_n,
-                                tinput->address_n_count, NULL) == 0) {
+  if (session_deriveNode(&node, tinput->address_n, tinput->address_n_count,
+                         NULL) == 0) {
     // Failed to derive private key
     return false;
   }
@@ -659,6 +668,12 @@ void signing_init(const SignTx* msg, const CoinType* _coin,
   multisig_fp_set = false;
   multisig_fp_mismatch = false;
   next_nonsegwit_input = 0xffffffff;
+  update_ctr = 0;
+
+  prevtx_cache_init();
+
+  outputs_cache_len = 0;
+  outputs_cache_valid = !_coin->decred;
 
   curve = get_curve_by_name(coin->curve_name);
   if (!curve) curve = get_curve_by_name(SECP256K1_NAME);
@@ -933,10 +948,24 @@ static bool signing_check_prevtx_hash(void) {
     signing_abort();
     return false;
   }
+  prevtx_cache_commit(input.prev_hash.bytes);
   phase1_request_next_input();
   return true;
 }
 
+static void signing_cache_output(const TxOutputBinType* txoutput) {
+  if (!outputs_cache_valid) return;
+
+  uint32_t r =
+      tx_serialize_output_raw(txoutput, outputs_cache + outputs_cache_len,
+                              sizeof(outputs_cache) - outputs_cache_len);
+  if (!r) {
+    outputs_cache_valid = false;
+    return;
+  }
+  outputs_cache_len += r;
+}
+
 static bool signing_check_output(TxOutputType* txoutput) {
   // Phase1: Check outputs
   //   add it to hash_outputs
@@ -1002,6 +1031,7 @@ static bool signing_check_output(TxOutputType* txoutput) {
   }
   //  compute segwit hashOuts
   tx_output_hash(&hasher_outputs, &bin_output, coin->decred);
+  signing_cache_output(&bin_output);
   return true;
 }
 
@@ -1227,7 +1257,7 @@ static bool signing_sign_hash(TxInputType* txinput, const uint8_t* private_key,
   return true;
 }
 
-static bool signing_sign_input(void) {
+static bool signing_check_hash_outputs(void) {
   uint8_t hash[32];
   hasher_Final(&hasher_check, hash);
   if (memcmp(hash, hash_outputs, 32) != 0) {
@@ -1236,7 +1266,11 @@ static bool signing_sign_input(void) {
     signing_abort();
     return false;
   }
+  return true;
+}
 
+static bool signing_sign_input(void) {
+  uint8_t hash[32];
   uint32_t hash_type = signing_hash_type();
   hasher_Update(&ti.hasher, (const uint8_t*)&hash_type, 4);
   tx_hash_final(&ti, hash, false);
@@ -1247,6 +1281,21 @@ static bool signing_sign_input(void) {
   return true;
 }
 
+static void phase2_input_signed(void) {
+  // since this took a longer time, update progress
+  signatures++;
+  progress = 500 + ((signatures * progress_step) >> PROGRESS_PRECISION);
+  layoutProgress(_("Signing transaction"), progress);
+  update_ctr = 0;
+  if (idx1 < inputs_count - 1) {
+    idx1++;
+    phase2_request_next_input();
+  } else {
+    idx1 = 0;
+    send_req_5_output();
+  }
+}
+
 static bool signing_sign_segwit_input(TxInputType* txinput) {
   // idx1: index to sign
 
@@ -1346,7 +1395,6 @@ void signing_txack(TransactionType* tx) {
     return;
   }
 
-  static int update_ctr = 0;
   if (update_ctr++ == 20) {
     layoutProgress(_("Signing transaction"), progress);
     update_ctr = 0;
@@ -1400,7 +1448,20 @@ void signing_txack(TransactionType* tx) {
           // remember the first non-segwit input -- this is the first input
           // we need to sign during phase2
           if (next_nonsegwit_input == 0xffffffff) next_nonsegwit_input = idx1;
-          send_req_2_prev_meta();
+          uint64_t amount;
+          if (prevtx_cache_lookup(input.prev_hash.bytes, input.prev_index,
+                                  &amount)) {
+            if (to_spend + amount < to_spend) {
+              fsm_sendFailure(FailureType_Failure_SyntaxError,
+                              _("Value overflow"));
+              signing_abort();
+              return;
+            }
+            to_spend += amount;
+            phase1_request_next_input();
+          } else {
+            send_req_2_prev_meta();
+          }
         }
       } else if (tx->inputs[0].script_type == InputScriptType_SPENDWITNESS ||
                  tx->inputs[0].script_type ==
@@ -1445,6 +1506,9 @@ void signing_txack(TransactionType* tx) {
 #else
         to.is_segwit = true;
 #endif
+        // The BIP143 signature commits to the amount, so segwit inputs are
+        // authorized up to it and their previous transaction is never
+        // requested; phase 2 spends from authorized_bip143_in.
         to_spend += tx->inputs[0].amount;
         authorized_bip143_in += tx->inputs[0].amount;
 
@@ -1537,6 +1601,11 @@ void signing_txack(TransactionType* tx) {
         }
         to_spend += tx->bin_outputs[0].amount;
       }
+      // Decred outputs with a script version are left out, so spending one
+      // streams its prevtx and fails the check above
+      if (!coin->decred || tx->bin_outputs[0].decred_script_version == 0) {
+        prevtx_cache_add(idx2, tx->bin_outputs[0].amount);
+      }
       if (idx2 < tp.outputs_len - 1) {
         /* Check prevtx of next input */
         idx2++;
@@ -1631,7 +1700,23 @@ void signing_txack(TransactionType* tx) {
         }
         hasher_Reset(&hasher_check);
         idx2 = 0;
-        send_req_4_output();
+        if (outputs_cache_valid) {
+          // outputs were compiled and confirmed in phase 1; hash them from
+          // the cache instead of asking for each one again
+          if (!tx_serialize_outputs_raw_hash(&ti, outputs_cache,
+                                             outputs_cache_len)) {
+            fsm_sendFailure(FailureType_Failure_Other,
+                            _("Failed to serialize output"));
+            signing_abort();
+            return;
+          }
+          if (!signing_sign_input()) {
+            return;
+          }
+          phase2_input_signed();
+        } else {
+          send_req_4_output();
+        }
       }
       return;
     case STAGE_REQUEST_4_OUTPUT:
@@ -1660,21 +1745,10 @@ void signing_txack(TransactionType* tx) {
         idx2++;
         send_req_4_output();
       } else {
-        if (!signing_sign_input()) {
+        if (!signing_check_hash_outputs() || !signing_sign_input()) {
           return;
         }
-        // since this took a longer time, update progress
-        signatures++;
-        progress = 500 + ((signatures * progress_step) >> PROGRESS_PRECISION);
-        layoutProgress(_("Signing transaction"), progress);
-        update_ctr = 0;
-        if (idx1 < inputs_count - 1) {
-          idx1++;
-          phase2_request_next_input();
-        } else {
-          idx1 = 0;
-          send_req_5_output();
-        }
+        phase2_input_signed();
       }
       return;
 
@@ -1902,4 +1976,6 @@ void signing_abort(void) {
   }
   memzero(&root, sizeof(root));
   memzero(&node, sizeof(node));
+  outputs_cache_len = 0;
+  outputs_cache_valid = false;
 }
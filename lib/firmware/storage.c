@@ -54,6 +54,7 @@
 #include "trezor/crypto/memzero.h"
 #include "trezor/crypto/pbkdf2.h"
 #include "trezor/crypto/rand.h"
+#include "trezor/crypto/sha2.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -90,6 +91,22 @@ _Static_assert(sizeof(ConfigFlash) <= FLASH_STORAGE_LEN,
                "ConfigFlash struct is too large for storage partition");
 static ConfigFlash CONFIDENTIAL shadow_config;
 
+/* The image as the active sector currently reads, log included. Commits
+   confined to the journaled fields append records after the image instead of
+   rewriting the sector. */
+static CONFIDENTIAL char storage_image[STORAGE_IMAGE_LEN];
+static uint32_t storage_log_chain;
+static uint32_t storage_log_end = STORAGE_LOG_END;  // full: rewrite first
+
+/* U2F authentications counted in the active sector's counter area, on top of
+   the u2f_counter in its image. */
+static uint32_t storage_u2f_offset;
+
+/* Shadow memory has changes not yet committed. */
+static bool storage_dirty;
+
+static bool storage_hasLog(const char* sector);
+
 #if DEBUG_LINK
 // These won't survive resets like the stuff in flash would, but thats a
 // reasonable compromise given how testing works.
@@ -129,17 +146,6 @@ bool storage_getU2FRoot(HDNode* node) {
                           NIST256P1_NAME, node);
 }
 
-uint32_t storage_nextU2FCounter(void) {
-  shadow_config.storage.pub.u2f_counter++;
-  storage_commit();
-  return shadow_config.storage.pub.u2f_counter;
-}
-
-void storage_setU2FCounter(uint32_t u2f_counter) {
-  shadow_config.storage.pub.u2f_counter = u2f_counter;
-  storage_commit();
-}
-
 static bool storage_isActiveSector(const char* flash) {
   return memcmp(((const Metadata*)flash)->magic, STORAGE_MAGIC_STR,
                 STORAGE_MAGIC_LEN) == 0;
@@ -165,8 +171,9 @@ static uint8_t read_u8(const char* ptr) { return *ptr; }
 static void write_u8(char* ptr, uint8_t val) { *ptr = val; }
 
 static uint32_t read_u32_le(const char* ptr) {
-  return ((uint32_t)ptr[0]) | ((uint32_t)ptr[1]) << 8 |
-         ((uint32_t)ptr[2]) << 16 | ((uint32_t)ptr[3]) << 24;
+  const uint8_t* p = (const uint8_t*)ptr;
+  return ((uint32_t)p[0]) | ((uint32_t)p[1]) << 8 | ((uint32_t)p[2]) << 16 |
+         ((uint32_t)p[3]) << 24;
 }
 
 static void write_u32_le(char* ptr, uint32_t val) {
@@ -180,6 +187,64 @@ static bool read_bool(const char* ptr) { return *ptr; }
 
 static void write_bool(char* ptr, bool val) { *ptr = val ? 1 : 0; }
 
+/// Clear the next bit of the active sector's U2F counter area.
+/// \returns false if the area is used up.
+static bool storage_u2fAreaIncrement(void) {
+  if (storage_location < FLASH_STORAGE1 || storage_location > FLASH_STORAGE3) {
+    return false;
+  }
+  if (storage_u2f_offset >= STORAGE_U2F_AREA_LEN * 8) return false;
+
+  uint32_t offset = STORAGE_U2F_AREA_START + storage_u2f_offset / 32 * 4;
+  uint32_t bits = storage_u2f_offset % 32 + 1;
+  char word[4];
+  write_u32_le(word, bits == 32 ? 0 : 0xFFFFFFFFu << bits);
+
+  const char* flash = (const char*)flash_write_helper(storage_location);
+  if (!flash_write_word(storage_location, offset, sizeof(word),
+                        (const uint8_t*)word) ||
+      memcmp(flash + offset, word, sizeof(word)) != 0) {
+    return false;
+  }
+
+  storage_u2f_offset++;
+  return true;
+}
+
+uint32_t storage_u2fAreaCount(const char* sector) {
+  if (!storage_hasLog(sector)) return 0;
+
+  uint32_t count = 0;
+  for (uint32_t offset = STORAGE_U2F_AREA_START; offset < STORAGE_SECTOR_LEN;
+       offset += 4) {
+    uint32_t word = read_u32_le(sector + offset);
+    count += 32 - __builtin_popcount(word);
+    if (word != 0) break;
+  }
+  return count;
+}
+
+uint32_t storage_nextU2FCounter(void) {
+  if (storage_u2fAreaIncrement()) {
+    return shadow_config.storage.pub.u2f_counter + storage_u2f_offset;
+  }
+
+  // Fold the area into the image, and start over in a fresh sector.
+  shadow_config.storage.pub.u2f_counter += storage_u2f_offset + 1;
+  storage_u2f_offset = 0;
+  storage_log_end = STORAGE_LOG_END;
+  storage_commit();
+  return shadow_config.storage.pub.u2f_counter;
+}
+
+void storage_setU2FCounter(uint32_t u2f_counter) {
+  // The area can't be cleared in place, so this needs a fresh sector too.
+  shadow_config.storage.pub.u2f_counter = u2f_counter;
+  storage_u2f_offset = 0;
+  storage_log_end = STORAGE_LOG_END;
+  storage_commitDeferred();
+}
+
 enum StorageVersion {
   StorageVersion_NONE,
 #define STORAGE_VERSION_ENTRY(VAL) StorageVersion_##VAL,
@@ -203,6 +268,12 @@ static enum StorageVersion version_from_int(int version) {
   }
 }
 
+/// \returns true iff \p sector is recent enough to carry a log and a U2F
+/// counter area after its image.
+static bool storage_hasLog(const char* sector) {
+  return version_from_int(read_u32_le(sector + 44)) >= StorageVersion_18;
+}
+
 void storage_readMeta(Metadata* meta, const char* ptr, size_t len) {
   if (len < 16 + STORAGE_UUID_STR_LEN) return;
   memcpy(meta->magic, ptr, STORAGE_MAGIC_LEN);
@@ -444,6 +515,42 @@ pintest_t storage_isWipeCodeCorrect_impl(const char* wipe_code,
   return ret;
 }
 
+/// Serialize the secrets in the layout that gets encrypted into encrypted_sec.
+static void storage_writeSec(char scratch[V17_ENCSEC_SIZE],
+                             const Storage* storage) {
+  memzero(scratch, V17_ENCSEC_SIZE);
+  storage_writeHDNode(&scratch[0], 129, &storage->sec.node);
+  memcpy(&scratch[0] + 129, storage->sec.mnemonic, 241);
+  storage_writeCacheV1(&scratch[0] + 370, 75, &storage->sec.cache);
+  memcpy(&scratch[0] + 512, &storage->sec.authBlock,
+         sizeof(storage->sec.authBlock));
+  // 129 reserved bytes
+}
+
+/// \returns true iff encrypted_sec already holds the current secrets in the
+/// current layout, i.e. they haven't changed since they were last encrypted
+/// or decrypted.
+static bool storage_secUnchanged(const Storage* storage) {
+  static CONFIDENTIAL char scratch[V17_ENCSEC_SIZE];
+
+  if (!storage->has_sec) return true;
+
+  if (!storage->has_sec_fingerprint ||
+      storage->encrypted_sec_version != STORAGE_VERSION) {
+    return false;
+  }
+
+  uint8_t sec_fingerprint[32];
+  storage_writeSec(scratch, storage);
+  sha256_Raw((const uint8_t*)scratch, sizeof(scratch), sec_fingerprint);
+  memzero(scratch, sizeof(scratch));
+
+  bool unchanged = memcmp_s(storage->sec_fingerprint, sec_fingerprint,
+                            sizeof(sec_fingerprint)) == 0;
+  memzero(sec_fingerprint, sizeof(sec_fingerprint));
+  return unchanged;
+}
+
 void storage_secMigrate(SessionState* ss, Storage* storage, bool encrypt) {
   static CONFIDENTIAL char scratch[V17_ENCSEC_SIZE];
   _Static_assert(sizeof(scratch) == sizeof(storage->encrypted_sec),
@@ -456,12 +563,7 @@ void storage_secMigrate(SessionState* ss, Storage* storage, bool encrypt) {
     memzero(storage->encrypted_sec, sizeof(storage->encrypted_sec));
 
     // Serialize to scratch.
-    storage_writeHDNode(&scratch[0], 129, &storage->sec.node);
-    memcpy(&scratch[0] + 129, storage->sec.mnemonic, 241);
-    storage_writeCacheV1(&scratch[0] + 370, 75, &storage->sec.cache);
-    memcpy(&scratch[0] + 512, &storage->sec.authBlock,
-           sizeof(storage->sec.authBlock));
-    // 129 reserved bytes
+    storage_writeSec(scratch, storage);
 
     // Take a fingerprint of the secrets so we can tell whether they've
     // been correctly decrypted later.
@@ -1148,6 +1250,16 @@ void storage_writeV17(char* flash, size_t len, const ConfigFlash* src) {
   storage_writeStorageV17(flash + 44, 852, &src->storage);
 }
 
+void storage_readV18(ConfigFlash* dst, const char* flash, size_t len) {
+  // The image is laid out as in v17. What v18 adds is the log and the U2F
+  // counter area after it, which storage_init() has already applied.
+  storage_readV17(dst, flash, len);
+}
+
+void storage_writeV18(char* flash, size_t len, const ConfigFlash* src) {
+  storage_writeV17(flash, len, src);
+}
+
 StorageUpdateStatus storage_fromFlash(SessionState* ss, ConfigFlash* dst,
                                       const char* flash) {
   memzero(dst, sizeof(*dst));
@@ -1202,6 +1314,10 @@ StorageUpdateStatus storage_fromFlash(SessionState* ss, ConfigFlash* dst,
       storage_readV17(dst, flash, STORAGE_SECTOR_LEN);
       dst->storage.version = STORAGE_VERSION;
       return dst->storage.version == version ? SUS_Valid : SUS_Updated;
+    case StorageVersion_18:
+      storage_readV18(dst, flash, STORAGE_SECTOR_LEN);
+      dst->storage.version = STORAGE_VERSION;
+      return dst->storage.version == version ? SUS_Valid : SUS_Updated;
 
     case StorageVersion_NONE:
       return SUS_Invalid;
@@ -1266,17 +1382,19 @@ static void storage_setRootSeedCache(const SessionState* ss, ConfigFlash* cfg,
 
   cfg->storage.sec.cache.root_seed_cache_status = CACHE_EXISTS;
   cfg->storage.has_sec = true;
-  storage_commit();
+  storage_commitDeferred();
 }
 
 /// \brief Get root session seed cache from storage.
 ///
+/// The BIP39 seed does not depend on the curve, so a seed cached while
+/// deriving for one curve is reused for all of them.
+///
 /// \param cfg[in]   The active storage sector.
-/// \param curve[in] ECDSA curve name being used.
 /// \param seed[out] The root seed value.
 /// \returns true on success.
 static bool storage_getRootSeedCache(const SessionState* ss,
-                                     const ConfigFlash* cfg, const char* curve,
+                                     const ConfigFlash* cfg,
                                      bool usePassphrase, uint8_t* seed) {
   if (!cfg->storage.has_sec) return false;
 
@@ -1288,10 +1406,6 @@ static bool storage_getRootSeedCache(const SessionState* ss,
     return false;
   }
 
-  if (strcmp(cfg->storage.sec.cache.root_ecdsa_curve_type, curve) != 0) {
-    return false;
-  }
-
   memset(seed, 0, sizeof(ss->seed));
   memcpy(seed, &cfg->storage.sec.cache.root_seed_cache,
          sizeof(cfg->storage.sec.cache.root_seed_cache));
@@ -1302,6 +1416,9 @@ static bool storage_getRootSeedCache(const SessionState* ss,
 }
 
 void storage_init(void) {
+  storage_log_end = STORAGE_LOG_END;
+  storage_u2f_offset = 0;
+
   // Find storage sector with valid data and set storage_location variable.
   if (!find_active_storage(&storage_location)) {
     // Otherwise initialize it to the default sector.
@@ -1327,8 +1444,10 @@ void storage_init(void) {
   data2hex(shadow_config.meta.uuid, sizeof(shadow_config.meta.uuid),
            shadow_config.meta.uuid_str);
 
-  // Load storage from flash, and update it if necessary.
-  switch (storage_fromFlash(&session, &shadow_config, flash)) {
+  // Apply the log, then load storage and update it if necessary.
+  storage_log_end = storage_replayLog(flash, storage_image, &storage_log_chain);
+  storage_u2f_offset = storage_u2fAreaCount(flash);
+  switch (storage_fromFlash(&session, &shadow_config, storage_image)) {
     case SUS_Invalid:
       storage_reset();
       storage_commit();
@@ -1337,7 +1456,9 @@ void storage_init(void) {
       break;
     case SUS_Updated:
       // If the version changed, write the new storage to flash so
-      // that it's available on next boot without conversion.
+      // that it's available on next boot without conversion. That takes a
+      // whole new sector, never a log record on top of the old layout.
+      storage_log_end = STORAGE_LOG_END;
       storage_commit();
       break;
   }
@@ -1365,7 +1486,11 @@ void storage_resetUuid_impl(ConfigFlash* cfg) {
   data2hex(cfg->meta.uuid, sizeof(cfg->meta.uuid), cfg->meta.uuid_str);
 }
 
-void storage_reset(void) { storage_reset_impl(&session, &shadow_config); }
+void storage_reset(void) {
+  storage_reset_impl(&session, &shadow_config);
+  storage_u2f_offset = 0;
+  storage_log_end = STORAGE_LOG_END;
+}
 
 void storage_reset_impl(SessionState* ss, ConfigFlash* cfg) {
   memset(&cfg->storage, 0, sizeof(cfg->storage));
@@ -1383,6 +1508,8 @@ void storage_reset_impl(SessionState* ss, ConfigFlash* cfg) {
 }
 
 void storage_wipe(void) {
+  storage_log_end = STORAGE_LOG_END;
+  storage_u2f_offset = 0;
   flash_erase_word(FLASH_STORAGE1);
   flash_erase_word(FLASH_STORAGE2);
   flash_erase_word(FLASH_STORAGE3);
@@ -1429,6 +1556,8 @@ pintest_t session_clear_impl(SessionState* ss, Storage* storage,
   ss->passphraseCached = false;
   memset(&ss->passphrase, 0, sizeof(ss->passphrase));
 
+  session_clearNodeCache(ss);
+
   if (!storage_hasPin_impl(storage)) {
     ret = storage_isPinCorrect_impl("", storage->pub.wrapped_storage_key,
                                     storage->pub.storage_key_fingerprint,
@@ -1459,23 +1588,213 @@ clear:
   return (ret);
 }
 
+/* Parts of the image that log records may rewrite: flags,
+   pin_failed_attempts, auto_lock_delay_ms, language and label, then
+   u2f_counter. The version, wrapped keys, salts and encrypted_sec only ever
+   change by rewriting the sector, so that the version older firmware checks
+   always describes the whole sector, and no stale copy of a secret lingers
+   in a log. */
+#define STORAGE_U2F_COUNTER_OFFSET (44 + 401)
+
+static const StorageLogSpan storage_log_windows[STORAGE_LOG_SPANS] = {
+    {44 + 4, 76},
+    {STORAGE_U2F_COUNTER_OFFSET, 4},
+};
+
+/// \returns true iff [offset, offset + len) lies within one log window.
+static bool storage_inLogWindow(uint32_t offset, uint32_t len) {
+  for (int w = 0; w < STORAGE_LOG_SPANS; w++) {
+    const StorageLogSpan* window = &storage_log_windows[w];
+    if (offset >= window->offset &&
+        offset + len <= (uint32_t)window->offset + window->len) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int storage_diffLog(const char* prev, const char* next,
+                    StorageLogSpan spans[STORAGE_LOG_SPANS]) {
+  int count = 0;
+  size_t pos = 0;
+
+  for (int w = 0; w < STORAGE_LOG_SPANS; w++) {
+    const StorageLogSpan* window = &storage_log_windows[w];
+    if (memcmp(prev + pos, next + pos, window->offset - pos) != 0) return -1;
+
+    size_t lo = window->offset, hi = window->offset + window->len;
+    while (lo < hi && prev[lo] == next[lo]) lo++;
+    while (hi > lo && prev[hi - 1] == next[hi - 1]) hi--;
+    if (lo < hi) {
+      spans[count].offset = lo;
+      spans[count].len = hi - lo;
+      count++;
+    }
+
+    pos = window->offset + window->len;
+  }
+
+  if (memcmp(prev + pos, next + pos, STORAGE_IMAGE_LEN - pos) != 0) return -1;
+
+  return count;
+}
+
+/// Checksum of a record: its header and padded payload, chained to the
+/// previous record so that records left over from another image never apply.
+static uint32_t storage_logChecksum(uint32_t chain, const uint8_t* record,
+                                    size_t len) {
+  uint32_t buf[2 + STORAGE_LOG_RECORD_MAX / sizeof(uint32_t)];
+  write_u32_le((char*)buf, chain);
+  memcpy((uint8_t*)buf + 4, record, len);
+  return calc_crc32(buf, 1 + len / sizeof(uint32_t));
+}
+
+size_t storage_encodeLogRecord(uint8_t* out, uint32_t* chain,
+                               const StorageLogSpan* span, const char* data) {
+  size_t padded = (span->len + 3) & ~3u;
+
+  write_u32_le((char*)out, span->offset | (uint32_t)span->len << 16);
+  memset(out + 4, 0, padded);
+  memcpy(out + 4, data, span->len);
+
+  *chain = storage_logChecksum(*chain, out, 4 + padded);
+  write_u32_le((char*)out + 4 + padded, *chain);
+  return 8 + padded;
+}
+
+uint32_t storage_replayLog(const char* sector, char image[STORAGE_IMAGE_LEN],
+                           uint32_t* chain) {
+  memcpy(image, sector, STORAGE_IMAGE_LEN);
+  *chain = calc_crc32(image, STORAGE_IMAGE_LEN / sizeof(uint32_t));
+
+  // Older sectors have no log; the next commit rewrites them.
+  if (!storage_hasLog(sector)) return STORAGE_LOG_END;
+
+  uint32_t pos = STORAGE_LOG_START;
+  while (pos + 4 <= STORAGE_LOG_END) {
+    uint32_t header = read_u32_le(sector + pos);
+    if (header == 0xFFFFFFFF) {
+      // Erased: this is where the next record goes.
+      return pos;
+    }
+
+    uint32_t offset = header & 0xffff, len = header >> 16;
+    size_t padded = (len + 3) & ~3u;
+    if (len == 0 || len > STORAGE_LOG_RECORD_MAX ||
+        !storage_inLogWindow(offset, len) ||
+        pos + 8 + padded > STORAGE_LOG_END) {
+      // Never written by storage_appendLog(), whatever its checksum says.
+      break;
+    }
+
+    uint32_t sum =
+        storage_logChecksum(*chain, (const uint8_t*)sector + pos, 4 + padded);
+    if (sum != read_u32_le(sector + pos + 4 + padded)) {
+      // Torn by a reset during the append.
+      break;
+    }
+
+    memcpy(image + offset, sector + pos + 4, len);
+    *chain = sum;
+    pos += 8 + padded;
+  }
+
+  return STORAGE_LOG_END;
+}
+
+/// Append the difference between the active sector and \p image as log
+/// records.
+/// \returns false if the sector has to be rewritten instead.
+static bool storage_appendLog(const char* image) {
+  StorageLogSpan spans[STORAGE_LOG_SPANS];
+  uint8_t record[STORAGE_LOG_RECORD_MAX + 8];
+
+  if (storage_location < FLASH_STORAGE1 || storage_location > FLASH_STORAGE3) {
+    return false;
+  }
+
+  if (storage_log_end >= STORAGE_LOG_END) return false;
+
+  int count = storage_diffLog(storage_image, image, spans);
+  if (count < 0) return false;
+
+  uint32_t end = storage_log_end;
+  for (int i = 0; i < count; i++) {
+    end += 8 + ((spans[i].len + 3) & ~3u);
+  }
+  if (end > STORAGE_LOG_END) return false;
+
+  const char* flash = (const char*)flash_write_helper(storage_location);
+  for (int i = 0; i < count; i++) {
+    size_t len = storage_encodeLogRecord(record, &storage_log_chain, &spans[i],
+                                         image + spans[i].offset);
+    if (!flash_write_word(storage_location, storage_log_end, len, record) ||
+        memcmp(flash + storage_log_end, record, len) != 0) {
+      // The sector may now end in a partial record.
+      storage_log_end = STORAGE_LOG_END;
+      memzero(record, sizeof(record));
+      return false;
+    }
+    memcpy(storage_image + spans[i].offset, image + spans[i].offset,
+           spans[i].len);
+    storage_log_end += len;
+  }
+
+  memzero(record, sizeof(record));
+
+  if (storage_protect_status() != STORAGE_PROTECT_DISABLED) {
+    storage_protect_off();
+  }
+  return true;
+}
+
+void storage_commitDeferred(void) { storage_dirty = true; }
+
+void storage_flush(void) {
+  if (storage_dirty) {
+    storage_commit();
+  }
+}
+
 void storage_commit(void) {
   // Temporary storage for marshalling secrets in & out of flash.
-  // Size of v17 storage layout (2525 bytes) + size of meta (44 bytes) + 1
-  static char flash_temp[2570];
+  static char flash_temp[STORAGE_IMAGE_LEN];
+
+  storage_dirty = false;
 
   memzero(flash_temp, sizeof(flash_temp));
 
-  if (session.pinCached || !shadow_config.storage.pub.has_pin) {
+  // Re-encrypting secrets that haven't changed gives back the ciphertext that
+  // is already on flash, so small changes skip it and can still be logged.
+  // Otherwise commit what was in storage->encrypted_sec.
+  bool migrate = session.pinCached || !shadow_config.storage.pub.has_pin;
+  if (migrate && !storage_secUnchanged(&shadow_config.storage)) {
     storage_secMigrate(&session, &shadow_config.storage, /*encrypt=*/true);
-  } else {
-    // commit what was in storage->encrypted_sec
+    migrate = false;
   }
 
-  storage_writeV17(flash_temp, sizeof(flash_temp), &shadow_config);
+  storage_writeV18(flash_temp, sizeof(flash_temp), &shadow_config);
 
   memcpy(&shadow_config, STORAGE_MAGIC_STR, STORAGE_MAGIC_LEN);
 
+  // Small changes go into the log of the active sector.
+  if (storage_appendLog(flash_temp)) {
+    memzero(flash_temp, sizeof(flash_temp));
+    return;
+  }
+
+  // A whole new sector always gets freshly encrypted secrets.
+  if (migrate && shadow_config.storage.has_sec) {
+    storage_secMigrate(&session, &shadow_config.storage, /*encrypt=*/true);
+    storage_writeV18(flash_temp, sizeof(flash_temp), &shadow_config);
+  }
+
+  // The next sector's counter area starts out erased.
+  shadow_config.storage.pub.u2f_counter += storage_u2f_offset;
+  storage_u2f_offset = 0;
+  write_u32_le(flash_temp + STORAGE_U2F_COUNTER_OFFSET,
+               shadow_config.storage.pub.u2f_counter);
+
   uint32_t retries = 0;
   for (retries = 0; retries < STORAGE_RETRIES; retries++) {
     /* Capture CRC for verification at restore */
@@ -1517,6 +1836,10 @@ void storage_commit(void) {
                    sizeof(flash_temp) / sizeof(uint32_t));
 
     if (shadow_flash_crc32 == shadow_ram_crc32) {
+      // The new sector starts with an empty log.
+      memcpy(storage_image, flash_temp, sizeof(storage_image));
+      storage_log_chain = shadow_ram_crc32;
+      storage_log_end = STORAGE_LOG_START;
       storage_protect_off();
       /* Commit successful, break to exit */
       break;
@@ -1608,6 +1931,7 @@ void storage_loadDevice(LoadDevice* msg) {
 #endif
     session.seedCached = false;
     memset(&session.seed, 0, sizeof(session.seed));
+    session_clearNodeCache(&session);
   } else if (msg->has_mnemonic) {
     shadow_config.storage.pub.has_mnemonic = true;
     shadow_config.storage.pub.has_node = false;
@@ -1622,6 +1946,7 @@ void storage_loadDevice(LoadDevice* msg) {
     shadow_config.storage.pub.has_u2froot = true;
     session.seedCached = false;
     memset(&session.seed, 0, sizeof(session.seed));
+    session_clearNodeCache(&session);
   }
 
   if (msg->has_language) {
@@ -1866,7 +2191,8 @@ const uint8_t* storage_getSeed(const ConfigFlash* cfg, bool usePassphrase) {
   return NULL;
 }
 
-bool storage_getRootNode(const char* curve, bool usePassphrase, HDNode* node) {
+static bool storage_deriveRootNode(const char* curve, bool usePassphrase,
+                                   HDNode* node) {
   // if storage has node, decrypt and use it
   if (shadow_config.storage.pub.has_node &&
       strcmp(curve, SECP256K1_NAME) == 0) {
@@ -1926,8 +2252,8 @@ bool storage_getRootNode(const char* curve, bool usePassphrase, HDNode* node) {
     }
 
     if (!session.seedCached) {
-      session.seedCached = storage_getRootSeedCache(
-          &session, &shadow_config, curve, usePassphrase, session.seed);
+      session.seedCached = storage_getRootSeedCache(&session, &shadow_config,
+                                                   usePassphrase, session.seed);
 
       if (!session.seedCached) {
         /* calculate session seed and update the global
@@ -1951,6 +2277,144 @@ bool storage_getRootNode(const char* curve, bool usePassphrase, HDNode* node) {
   return false;
 }
 
+bool storage_getRootNode(const char* curve, bool usePassphrase, HDNode* node) {
+  const curve_info* info = get_curve_by_name(curve);
+
+  const HDNode* cached = session_getCachedRoot(&session, info, usePassphrase);
+  if (cached) {
+    memcpy(node, cached, sizeof(*node));
+    return true;
+  }
+
+  if (!storage_deriveRootNode(curve, usePassphrase, node)) {
+    return false;
+  }
+
+  if (info) {
+    session_cacheRoot(&session, info, usePassphrase, node);
+  }
+  return true;
+}
+
+const HDNode* session_getCachedRoot(const SessionState* ss,
+                                    const curve_info* curve,
+                                    bool usePassphrase) {
+  if (!curve) return NULL;
+
+  for (size_t i = 0; i < SESSION_ROOT_CACHE_SIZE; i++) {
+    const SessionRoot* root = &ss->rootCache[i];
+    if (root->curve == curve && root->usesPassphrase == usePassphrase) {
+      return &root->node;
+    }
+  }
+
+  return NULL;
+}
+
+void session_cacheRoot(SessionState* ss, const curve_info* curve,
+                       bool usePassphrase, const HDNode* node) {
+  SessionRoot* root = &ss->rootCache[ss->rootCacheNext];
+  ss->rootCacheNext = (ss->rootCacheNext + 1) % SESSION_ROOT_CACHE_SIZE;
+
+  root->curve = curve;
+  root->usesPassphrase = usePassphrase;
+  memcpy(&root->node, node, sizeof(root->node));
+  hdnode_fill_public_key(&root->node);
+}
+
+void session_clearNodeCache(SessionState* ss) {
+  memzero(ss->rootCache, sizeof(ss->rootCache));
+  ss->rootCacheNext = 0;
+  memzero(ss->nodeCache, sizeof(ss->nodeCache));
+  ss->nodeCacheTick = 0;
+}
+
+/// Identify the root a cached node was derived from without keeping a copy
+/// of the root's key material around.
+static void session_rootTag(const HDNode* root, uint8_t tag[32]) {
+  SHA256_CTX ctx;
+  sha256_Init(&ctx);
+  sha256_Update(&ctx, root->chain_code, sizeof(root->chain_code));
+  sha256_Update(&ctx, root->private_key, sizeof(root->private_key));
+  sha256_Final(&ctx, tag);
+}
+
+int session_deriveNode_impl(SessionState* ss, HDNode* inout,
+                            const uint32_t* address_n, size_t address_n_count,
+                            uint32_t* fingerprint) {
+  if (address_n_count == 0) {
+    return 1;
+  }
+
+  size_t prefix = address_n_count - 1;
+  if (prefix == 0 || prefix > SESSION_NODE_CACHE_DEPTH) {
+    for (size_t i = 0; i < prefix; i++) {
+      if (hdnode_private_ckd(inout, address_n[i]) == 0) {
+        return 0;
+      }
+    }
+  } else {
+    uint8_t tag[32];
+    session_rootTag(inout, tag);
+
+    SessionNode* hit = NULL;
+    SessionNode* victim = &ss->nodeCache[0];
+    for (size_t i = 0; i < SESSION_NODE_CACHE_SIZE; i++) {
+      SessionNode* entry = &ss->nodeCache[i];
+      if (!entry->valid) {
+        if (victim->valid) victim = entry;
+        continue;
+      }
+      if (entry->address_n_count == prefix &&
+          entry->node.curve == inout->curve &&
+          memcmp(entry->root_tag, tag, sizeof(tag)) == 0 &&
+          memcmp(entry->address_n, address_n, prefix * sizeof(uint32_t)) ==
+              0) {
+        hit = entry;
+        break;
+      }
+      if (victim->valid && entry->last_used < victim->last_used) {
+        victim = entry;
+      }
+    }
+
+    if (!hit) {
+      for (size_t i = 0; i < prefix; i++) {
+        if (hdnode_private_ckd(inout, address_n[i]) == 0) {
+          memzero(tag, sizeof(tag));
+          return 0;
+        }
+      }
+      hit = victim;
+      hit->valid = true;
+      memcpy(hit->root_tag, tag, sizeof(tag));
+      memcpy(hit->address_n, address_n, prefix * sizeof(uint32_t));
+      hit->address_n_count = prefix;
+      memcpy(&hit->node, inout, sizeof(HDNode));
+    }
+    memzero(tag, sizeof(tag));
+
+    // Non-hardened children and fingerprints both need the parent's public
+    // key; keep it in the cache so the point multiplication happens once.
+    if (fingerprint || !(address_n[prefix] & 0x80000000)) {
+      hdnode_fill_public_key(&hit->node);
+    }
+    hit->last_used = ++ss->nodeCacheTick;
+    memcpy(inout, &hit->node, sizeof(HDNode));
+  }
+
+  if (fingerprint) {
+    *fingerprint = hdnode_fingerprint(inout);
+  }
+  return hdnode_private_ckd(inout, address_n[prefix]);
+}
+
+int session_deriveNode(HDNode* inout, const uint32_t* address_n,
+                       size_t address_n_count, uint32_t* fingerprint) {
+  return session_deriveNode_impl(&session, inout, address_n, address_n_count,
+                                 fingerprint);
+}
+
 bool storage_isInitialized(void) {
   return shadow_config.storage.pub.has_node ||
          shadow_config.storage.pub.has_mnemonic;
@@ -1964,11 +2428,13 @@ bool storage_getPassphraseProtected(void) {
 
 void storage_setPassphraseProtected(bool passphrase) {
   shadow_config.storage.pub.passphrase_protection = passphrase;
+  session_clearNodeCache(&session);
 }
 
 void session_cachePassphrase(const char* passphrase) {
   strlcpy(session.passphrase, passphrase, sizeof(session.passphrase));
   session.passphraseCached = true;
+  session_clearNodeCache(&session);
 }
 
 bool session_isPassphraseCached(void) { return session.passphraseCached; }
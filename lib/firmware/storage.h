@@ -94,6 +94,28 @@ typedef struct _ConfigFlash {
   Storage storage;
 } ConfigFlash;
 
+#define SESSION_NODE_CACHE_SIZE 8
+#define SESSION_NODE_CACHE_DEPTH 8
+
+/// A derived parent node, reused by later derivations sharing its prefix.
+typedef struct _SessionNode {
+  bool valid;
+  uint32_t last_used;
+  uint8_t root_tag[32];  // sha256(root chain code || root private key)
+  uint32_t address_n[SESSION_NODE_CACHE_DEPTH];
+  size_t address_n_count;
+  HDNode node;  // public key always filled
+} SessionNode;
+
+#define SESSION_ROOT_CACHE_SIZE 6
+
+/// A root node for one curve, so hdnode_from_seed() runs once per session.
+typedef struct _SessionRoot {
+  const curve_info* curve;  // NULL when the slot is empty
+  bool usesPassphrase;
+  HDNode node;  // public key always filled
+} SessionRoot;
+
 typedef struct _SessionState {
   bool seedUsesPassphrase;
   bool seedCached;
@@ -104,6 +126,12 @@ typedef struct _SessionState {
 
   bool passphraseCached;
   char passphrase[51];
+
+  size_t rootCacheNext;
+  SessionRoot rootCache[SESSION_ROOT_CACHE_SIZE];
+
+  uint32_t nodeCacheTick;
+  SessionNode nodeCache[SESSION_NODE_CACHE_SIZE];
 } SessionState;
 
 typedef enum {
@@ -114,6 +142,25 @@ typedef enum {
 
 #define MAX_MNEMONIC_LEN 240
 
+/// Forget all root and derived nodes cached for the session.
+void session_clearNodeCache(SessionState* ss);
+
+/// \returns the cached root node for \p curve, or NULL on a miss.
+const HDNode* session_getCachedRoot(const SessionState* ss,
+                                    const curve_info* curve,
+                                    bool usePassphrase);
+
+/// Remember \p node as the root for \p curve, filling its public key.
+void session_cacheRoot(SessionState* ss, const curve_info* curve,
+                       bool usePassphrase, const HDNode* node);
+
+/// Derive \p inout (initially the root node) along \p address_n, starting
+/// from the deepest cached parent and caching the final node's parent.
+/// \returns nonzero iff successful, like hdnode_private_ckd_cached().
+int session_deriveNode_impl(SessionState* ss, HDNode* inout,
+                            const uint32_t* address_n, size_t address_n_count,
+                            uint32_t* fingerprint);
+
 void storage_loadNode(HDNode* dst, const HDNodeType* src);
 
 /// Derive the wrapping key from the user's pin.
@@ -187,6 +234,53 @@ typedef enum {
   SUS_Updated,
 } StorageUpdateStatus;
 
+/// Size of the image: v17 storage layout (2525 bytes) + meta (44) + 1.
+#define STORAGE_IMAGE_LEN 2570
+
+/// From v18 on, log records are appended after the image, up to the U2F
+/// counter area. Older firmware doesn't know about either, and must not read
+/// the image alone, so they come with the version bump.
+#define STORAGE_LOG_START 2572
+#define STORAGE_LOG_END STORAGE_U2F_AREA_START
+#define STORAGE_LOG_RECORD_MAX 80
+#define STORAGE_LOG_SPANS 2
+
+/// A byte range of the image rewritten by one log record.
+typedef struct _StorageLogSpan {
+  uint16_t offset;
+  uint16_t len;
+} StorageLogSpan;
+
+/// The last words of the sector count U2F authentications since the image
+/// was written, one cleared bit per authentication.
+#define STORAGE_U2F_AREA_LEN 512
+#define STORAGE_U2F_AREA_START (STORAGE_SECTOR_LEN - STORAGE_U2F_AREA_LEN)
+
+/// \returns the number of bits cleared in the U2F counter area of \p sector,
+///          or 0 if the sector predates the area.
+uint32_t storage_u2fAreaCount(const char* sector);
+
+/// Find the byte ranges that differ between two images.
+/// \returns the number of spans, or -1 if anything outside of the parts of
+///          the image that may be journaled changed.
+int storage_diffLog(const char* prev, const char* next,
+                    StorageLogSpan spans[STORAGE_LOG_SPANS]);
+
+/// Serialize a record setting the \p span of the image to \p data.
+/// \param chain[in,out]  Checksum of the previous record, or of the image.
+/// \returns the length of the record, at most STORAGE_LOG_RECORD_MAX + 8.
+size_t storage_encodeLogRecord(uint8_t* out, uint32_t* chain,
+                               const StorageLogSpan* span, const char* data);
+
+/// Copy the image at the start of \p sector and apply the log that follows,
+/// if the sector is recent enough to have one. A record reaching outside the
+/// journaled windows ends the log like a torn one.
+/// \param chain[out]  Checksum of the last record applied.
+/// \returns where the next record goes, or STORAGE_LOG_END if the log is
+///          full or damaged and the next commit must rewrite the sector.
+uint32_t storage_replayLog(const char* sector, char image[STORAGE_IMAGE_LEN],
+                           uint32_t* chain);
+
 /// \brief Copy configuration from storage partition in flash memory to shadow
 /// memory in RAM
 /// \returns true iff successful.
@@ -203,8 +297,10 @@ void storage_readV2(SessionState* ss, ConfigFlash* dst, const char* flash,
                     size_t len);
 void storage_readV11(ConfigFlash* dst, const char* flash, size_t len);
 void storage_readV16(ConfigFlash* dst, const char* flash, size_t len);
+void storage_readV18(ConfigFlash* dst, const char* flash, size_t len);
 void storage_writeV11(char* flash, size_t len, const ConfigFlash* src);
 void storage_writeV16(char* flash, size_t len, const ConfigFlash* src);
+void storage_writeV18(char* flash, size_t len, const ConfigFlash* src);
 
 void storage_readMeta(Metadata* meta, const char* ptr, size_t len);
 void storage_readPolicyV1(PolicyType* policy, const char* ptr, size_t len);
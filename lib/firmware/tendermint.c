@@ -4,8 +4,10 @@
 #include "trezor/crypto/segwit_addr.h"
 #include "trezor/crypto/sha2.h"
 
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 static int convert_bits(uint8_t* out, size_t* outlen, int outbits,
                         const uint8_t* in, size_t inlen, int inbits, int pad) {
@@ -64,29 +66,110 @@ bool tendermint_getAddress(const HDNode* node, const char* prefix,
                        BECH32_ENCODING_BECH32) == 1;
 }
 
+#define WORD_ONES ((size_t)-1 / 0xff)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+#define WORD_HAS_ZERO(w) (((w)-WORD_ONES) & ~(w)&WORD_HIGHS)
+#define WORD_HAS_BYTE(w, c) WORD_HAS_ZERO((w) ^ (WORD_ONES * (uint8_t)(c)))
+
+/// \returns the length of the leading run of \p s that needs no escaping.
+static size_t tendermint_plainRun(const char* s, size_t len) {
+  size_t i = 0;
+  for (; i + sizeof(size_t) <= len; i += sizeof(size_t)) {
+    size_t w;
+    memcpy(&w, s + i, sizeof(w));
+    if (WORD_HAS_BYTE(w, '"') || WORD_HAS_BYTE(w, '\\')) break;
+  }
+  while (i < len && s[i] != '"' && s[i] != '\\') i++;
+  return i;
+}
+
 void tendermint_sha256UpdateEscaped(SHA256_CTX* ctx, const char* s,
                                     size_t len) {
-  for (size_t i = 0; i != len; i++) {
-    if (s[i] == '"') {
-      sha256_Update(ctx, (const uint8_t*)"\\\"", 2);
-    } else if (s[i] == '\\') {
-      sha256_Update(ctx, (const uint8_t*)"\\\\", 2);
+  while (len) {
+    size_t run = tendermint_plainRun(s, len);
+    if (run) {
+      sha256_Update(ctx, (const uint8_t*)s, run);
+      s += run;
+      len -= run;
+      if (!len) break;
+    }
+    sha256_Update(ctx, (const uint8_t*)(*s == '"' ? "\\\"" : "\\\\"), 2);
+    s++;
+    len--;
+  }
+}
+
+/// Append \p v in decimal to out[*n], counting past the end of \p len.
+static void tendermint_formatU64(char* out, size_t len, size_t* n,
+                                 uint64_t v) {
+  char digits[20];
+  size_t d = 0;
+  do {
+    digits[d++] = '0' + (v % 10);
+    v /= 10;
+  } while (v);
+  while (d) {
+    char c = digits[--d];
+    if (*n < len) out[*n] = c;
+    (*n)++;
+  }
+}
+
+/// Formats the subset of printf used by the sign doc templates: %s, %u, %lu,
+/// %llu and %%. A NULL string prints as "(null)", as with vsnprintf.
+/// \returns the untruncated length, or -1 for any other conversion or if
+///          the length doesn't fit in an int.
+static int tendermint_vformat(char* out, size_t len, const char* format,
+                              va_list vl) {
+  size_t n = 0;
+  for (const char* f = format; *f; f++) {
+    if (*f != '%') {
+      if (n < len) out[n] = *f;
+      n++;
+      continue;
+    }
+
+    f++;
+    int longs = 0;
+    while (*f == 'l') {
+      longs++;
+      f++;
+    }
+
+    if (*f == 's' && longs == 0) {
+      const char* a = va_arg(vl, const char*);
+      for (a = a ? a : "(null)"; *a; a++) {
+        if (n < len) out[n] = *a;
+        n++;
+      }
+    } else if (*f == 'u') {
+      uint64_t v = longs == 0   ? va_arg(vl, unsigned)
+                   : longs == 1 ? va_arg(vl, unsigned long)
+                                : va_arg(vl, unsigned long long);
+      tendermint_formatU64(out, len, &n, v);
+    } else if (*f == '%' && longs == 0) {
+      if (n < len) out[n] = '%';
+      n++;
     } else {
-      // The copy here is required (as opposed to a cast), since the
-      // source is a character array, and sha256_Update uses it as if it
-      // were an array of uint8_t, which would violate the strict aliasing
-      // rule.
-      const uint8_t c = s[i];
-      sha256_Update(ctx, &c, 1);
+      return -1;
     }
   }
+
+  if (n > INT_MAX) return -1;
+  if (len) out[n < len ? n : len - 1] = '\0';
+  return (int)n;
 }
 
 bool tendermint_snprintf(SHA256_CTX* ctx, char* temp, size_t len,
                          const char* format, ...) {
-  va_list vl;
+  va_list vl, fallback;
   va_start(vl, format);
-  int n = vsnprintf(temp, len, format, vl);
+  va_copy(fallback, vl);
+  int n = tendermint_vformat(temp, len, format, vl);
+  if (n < 0) {
+    n = vsnprintf(temp, len, format, fallback);
+  }
+  va_end(fallback);
   va_end(vl);
 
   if (n < 0 || (size_t)n >= len) return false;
@@ -27,6 +27,7 @@
 #include "keepkey/firmware/coins.h"
 #include "keepkey/firmware/crypto.h"
 #include "keepkey/firmware/signing.h"
+#include "keepkey/firmware/storage.h"
 #include "keepkey/firmware/thorchain.h"
 #include "keepkey/firmware/txin_check.h"
 #include "keepkey/transport/interface.h"
@@ -280,8 +281,8 @@ int compile_output(const CoinType* coin, const HDNode* root, TxOutputType* in,
         return 0;  // failed to compile output
     }
     memcpy(&node, root, sizeof(HDNode));
-    if (hdnode_private_ckd_cached(&node, in->address_n, in->address_n_count,
-                                  NULL) == 0) {
+    if (session_deriveNode(&node, in->address_n, in->address_n_count, NULL) ==
+        0) {
       return 0;  // failed to compile output
     }
     hdnode_fill_public_key(&node);
@@ -872,6 +873,41 @@ uint32_t tx_serialize_output_hash(TxStruct* tx, const TxOutputBinType* output) {
   return r;
 }
 
+/// Append the serialized form of one output (amount and script) to a run of
+/// them for tx_serialize_outputs_raw_hash(). Returns the bytes written, or 0
+/// if they would not fit in out_len.
+uint32_t tx_serialize_output_raw(const TxOutputBinType* output, uint8_t* out,
+                                 uint32_t out_len) {
+  uint32_t size = output->script_pubkey.size;
+  if (8 + ser_length_size(size) + size > out_len) return 0;
+
+  memcpy(out, &output->amount, 8);
+  return 8 + tx_serialize_script(size, output->script_pubkey.bytes, out + 8);
+}
+
+/// Hash all outputs at once from their already serialized form (amount and
+/// script of each, without the count and footer).
+uint32_t tx_serialize_outputs_raw_hash(TxStruct* tx, const uint8_t* data,
+                                      uint32_t datalen) {
+  if (tx->have_inputs < tx->inputs_len) {
+    // not all inputs provided
+    return 0;
+  }
+  if (tx->have_outputs != 0) {
+    // outputs already started
+    return 0;
+  }
+  uint32_t r = tx_serialize_middle_hash(tx);
+  hasher_Update(&(tx->hasher), data, datalen);
+  r += datalen;
+  tx->have_outputs = tx->outputs_len;
+  if (!tx->is_segwit) {
+    r += tx_serialize_footer_hash(tx);
+  }
+  tx->size += r;
+  return r;
+}
+
 uint32_t tx_serialize_extra_data_hash(TxStruct* tx, const uint8_t* data,
                                       uint32_t datalen) {
   if (tx->have_inputs < tx->inputs_len) {
@@ -27,6 +27,7 @@ extern "C" {
 #include "keepkey/board/usb.h"
 #include "keepkey/board/resources.h"
 #include "keepkey/board/keepkey_usart.h"
+#include "keepkey/emulator/emulator.h"
 #include "keepkey/emulator/setup.h"
 #include "keepkey/firmware/app_layout.h"
 #include "keepkey/firmware/home_sm.h"
@@ -46,7 +47,17 @@ extern "C" {
 const char *const application_version = APP_VERSIONS;
 
 static void exec(void) {
-  usbPoll();
+  // Sleep until a report arrives or the next timer tick, then drain
+  // everything that is queued instead of one report per tick.
+  if (emulatorSocketWait(1)) {
+    do {
+      usbPoll();
+    } while (emulatorSocketWait(0));
+  }
+
+  /* Write back settings changed by the messages just handled */
+  storage_flush();
+
   animate();
   display_refresh();
 }
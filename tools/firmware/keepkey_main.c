@@ -163,6 +163,9 @@ static void check_bootloader(void) {
 static void exec(void) {
   usbPoll();
 
+  /* Write back settings changed by the messages just handled */
+  storage_flush();
+
   /* Attempt to animate should a screensaver be present */
   animate();
   display_refresh();
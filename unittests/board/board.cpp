@@ -1,9 +1,97 @@
 extern "C" {
 #include "keepkey/board/keepkey_board.h"
+#include "keepkey/board/keepkey_flash.h"
 }
 
 #include "gtest/gtest.h"
 
+#include <vector>
+
 TEST(Board, Shutdown) {
   EXPECT_EXIT(shutdown(), ::testing::ExitedWithCode(1), "");
 }
+
+// Bit at a time, exactly as the STM32 CRC unit processes each word.
+static uint32_t stm32_crc32(const uint32_t* words, int word_len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (int i = 0; i < word_len; i++) {
+    crc ^= words[i];
+    for (int j = 0; j < 32; j++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+TEST(Board, CalcCrc32KnownVectors) {
+  const uint32_t word = 0x12345678;
+  EXPECT_EQ(calc_crc32(&word, 1), 0xDF8A8A2Bu);
+
+  const uint32_t zero = 0;
+  EXPECT_EQ(calc_crc32(&zero, 1), 0xC704DD7Bu);
+
+  // "12345678" fed as big-endian words, i.e. CRC-32/MPEG-2.
+  const uint32_t ascii[2] = {0x31323334, 0x35363738};
+  EXPECT_EQ(calc_crc32(ascii, 2), 0x49E3C2FBu);
+
+  EXPECT_EQ(calc_crc32(ascii, 0), 0xFFFFFFFFu);
+}
+
+TEST(Board, CalcCrc32MatchesBitwise) {
+  uint32_t words[643];
+  uint32_t x = 0x2545F491;
+  for (auto& w : words) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    w = x;
+  }
+
+  for (int len : {1, 2, 3, 7, 8, 642, 643}) {
+    EXPECT_EQ(calc_crc32(words, len), stm32_crc32(words, len)) << len;
+  }
+}
+
+TEST(Board, FlashDirtyRanges) {
+  std::vector<uint8_t> flash(FLASH_TOTAL_SIZE, 0xff);
+  uint8_t* saved_base = emulator_flash_base;
+  emulator_flash_base = flash.data();
+  const uint8_t data[STOR_FLASH_SECT_LEN] = {0};
+
+  // Straddling the end of storage sector 1 dirties sector 2 as well, and the
+  // two merge into one range.
+  flash_clearDirty();
+  ASSERT_TRUE(flash_write(FLASH_STORAGE1, STOR_FLASH_SECT_LEN - 8, 16, data));
+  EXPECT_EQ(flash_getDirty(), (1u << 1) | (1u << 2));
+
+  FlashRange ranges[2] = {};
+  ASSERT_EQ(flash_dirtyRanges(flash_getDirty(), ranges, 2), 1u);
+  EXPECT_EQ(ranges[0].offset, 0x4000u);
+  EXPECT_EQ(ranges[0].len, 2u * STOR_FLASH_SECT_LEN);
+
+  // A sector apart from the others starts a new range. With room for one, the
+  // total is still reported and the rest is left alone.
+  ASSERT_TRUE(flash_write(FLASH_APP, 0, 4, data));
+  EXPECT_EQ(flash_getDirty(), (1u << 1) | (1u << 2) | (1u << 7));
+
+  ranges[1] = {0xdead, 0xbeef};
+  ASSERT_EQ(flash_dirtyRanges(flash_getDirty(), ranges, 1), 2u);
+  EXPECT_EQ(ranges[0].offset, 0x4000u);
+  EXPECT_EQ(ranges[0].len, 2u * STOR_FLASH_SECT_LEN);
+  EXPECT_EQ(ranges[1].offset, 0xdeadu);
+  EXPECT_EQ(ranges[1].len, 0xbeefu);
+
+  ASSERT_EQ(flash_dirtyRanges(flash_getDirty(), ranges, 2), 2u);
+  EXPECT_EQ(ranges[1].offset, 0x60000u);
+  EXPECT_EQ(ranges[1].len, (uint32_t)APP_FLASH_SECT_LEN);
+
+  // Filling a sector exactly stops short of the next one.
+  flash_clearDirty();
+  ASSERT_TRUE(flash_write(FLASH_STORAGE3, 0, STOR_FLASH_SECT_LEN, data));
+  EXPECT_EQ(flash_getDirty(), 1u << 3);
+
+  flash_clearDirty();
+  EXPECT_EQ(flash_dirtyRanges(flash_getDirty(), ranges, 2), 0u);
+
+  emulator_flash_base = saved_base;
+}
@@ -0,0 +1,75 @@
+extern "C" {
+#include "keepkey/board/draw.h"
+#include "keepkey/board/keepkey_display.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+static CanvasRect dumped;
+
+TEST(Board, CanvasDirtyRect) {
+  Canvas *canvas = display_canvas_init();
+  ASSERT_EQ(canvas->dirty_rect.width, 0);
+
+  draw_box_simple(canvas, 0xff, 10, 5, 4, 3);
+  draw_box_simple(canvas, 0xff, 100, 20, 8, 2);
+  EXPECT_TRUE(canvas->dirty);
+  EXPECT_EQ(canvas->dirty_rect.x, 10);
+  EXPECT_EQ(canvas->dirty_rect.y, 5);
+  EXPECT_EQ(canvas->dirty_rect.width, 98);
+  EXPECT_EQ(canvas->dirty_rect.height, 17);
+
+  // Clipped to the canvas.
+  canvas_mark_dirty(canvas, 250, 60, 20, 20);
+  EXPECT_EQ(canvas->dirty_rect.width, 246);
+  EXPECT_EQ(canvas->dirty_rect.height, 59);
+
+  display_set_dump_callback(+[](const uint8_t *, const CanvasRect *changed) {
+    dumped = *changed;
+  });
+
+  display_refresh();
+  EXPECT_EQ(dumped.x, 10);
+  EXPECT_EQ(dumped.width, 246);
+  EXPECT_FALSE(canvas->dirty);
+  EXPECT_EQ(canvas->dirty_rect.width, 0);
+
+  // Nothing drawn since the last refresh.
+  display_refresh();
+  EXPECT_EQ(dumped.width, 0);
+
+  display_set_dump_callback(nullptr);
+}
+
+TEST(Board, CanvasPackMono) {
+  static uint8_t buf[64 * 256];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (i * 2654435761u) >> 29 ? 0 : (uint8_t)(i | 1);
+  }
+
+  uint8_t expected[2048] = {0};
+  for (int x = 0; x < 256; x++) {
+    for (int y = 0; y < 64; y++) {
+      if (buf[y * 256 + x] > 0) {
+        expected[x + (y / 8) * 256] |= (1 << (y % 8));
+      }
+    }
+  }
+
+  uint8_t packed[2048];
+  memset(packed, 0xa5, sizeof(packed));
+  canvas_pack_mono(buf, 256, 0, 256, 0, 8, packed);
+  EXPECT_EQ(memcmp(packed, expected, sizeof(packed)), 0);
+
+  // Unaligned sub-rectangle leaves everything else alone.
+  memset(packed, 0xa5, sizeof(packed));
+  canvas_pack_mono(buf, 256, 3, 250, 2, 5, packed);
+  for (int p = 0; p < 8; p++) {
+    for (int x = 0; x < 256; x++) {
+      bool inside = p >= 2 && p < 5 && x >= 3 && x < 250;
+      ASSERT_EQ(packed[p * 256 + x], inside ? expected[p * 256 + x] : 0xa5);
+    }
+  }
+}
@@ -0,0 +1,35 @@
+extern "C" {
+#include "keepkey/board/canvas.h"
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Micro-benchmark for the 8bpp -> 1bpp screenshot packer. ctest runs a short
+// pass to keep it building and running; for timings run it by hand:
+// ./canvas-pack-bench [iterations]
+int main(int argc, char *argv[]) {
+  static uint8_t buf[64 * 256];
+  static uint8_t packed[2048];
+  long iterations = argc > 1 ? atol(argv[1]) : 100000;
+  if (iterations <= 0) return 1;
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (i * 2654435761u) >> 30 ? 0 : 0xff;
+  }
+
+  unsigned sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++) {
+    buf[i % sizeof(buf)] ^= 1;
+    canvas_pack_mono(buf, 256, 0, 256, 0, 8, packed);
+    sink += packed[i % sizeof(packed)];
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start);
+
+  printf("canvas_pack_mono 256x64: %.1f ns/frame (%u)\n",
+         elapsed.count() / iterations, sink);
+  return 0;
+}
@@ -0,0 +1,126 @@
+extern "C" {
+#include "keepkey/board/timer.h"
+}
+
+#include "gtest/gtest.h"
+
+static int fired_a;
+static int fired_b;
+static uint32_t fired_at;
+
+static void count_a(void *context) {
+  (void)context;
+  fired_a++;
+  fired_at = getSysTime();
+}
+
+static void count_b(void *context) {
+  (void)context;
+  fired_b++;
+}
+
+// Like the confirm state machine, reschedule from inside a runnable.
+static void chain_b(void *context) {
+  count_a(context);
+  post_delayed(&count_b, nullptr, 1);
+}
+
+static void setup() {
+  kk_timer_init();
+  fired_a = 0;
+  fired_b = 0;
+  fired_at = 0;
+}
+
+TEST(Timer, AdvanceKeepsSysTime) {
+  setup();
+  uint32_t start = getSysTime();
+
+  timer_advance_ms(1);
+  EXPECT_EQ(getSysTime() - start, 1u);
+
+  post_periodic(&count_a, nullptr, 20, 20);
+  post_delayed(&count_b, nullptr, 7);
+  timer_advance_ms(10 * 60 * 60 * 1000);
+  EXPECT_EQ(getSysTime() - start, 1u + 10 * 60 * 60 * 1000);
+
+  clear_runnables();
+}
+
+TEST(Timer, AdvanceFiresDelayedOnItsTick) {
+  setup();
+  uint32_t start = getSysTime();
+
+  post_delayed(&count_a, nullptr, 50);
+  EXPECT_EQ(timer_next_deadline_ms(), 50u);
+
+  timer_advance_ms(49);
+  EXPECT_EQ(fired_a, 0);
+  EXPECT_EQ(timer_next_deadline_ms(), 1u);
+
+  timer_advance_ms(1000);
+  EXPECT_EQ(fired_a, 1);
+  EXPECT_EQ(fired_at - start, 50u);
+  EXPECT_EQ(timer_next_deadline_ms(), UINT32_MAX);
+}
+
+TEST(Timer, AdvanceMatchesSingleTicks) {
+  setup();
+
+  post_periodic(&count_a, nullptr, 20, 20);
+  for (int i = 0; i < 100; i++) {
+    timer_advance_ms(1);
+  }
+  EXPECT_EQ(fired_a, 5);
+  EXPECT_EQ(timer_next_deadline_ms(), 20u);
+
+  // Within one period, batching changes nothing.
+  timer_advance_ms(19);
+  EXPECT_EQ(fired_a, 5);
+  timer_advance_ms(1);
+  EXPECT_EQ(fired_a, 6);
+
+  clear_runnables();
+}
+
+TEST(Timer, AdvanceCoalescesPeriodic) {
+  setup();
+  uint32_t start = getSysTime();
+
+  post_periodic(&count_a, nullptr, 20, 20);
+  timer_advance_ms(1000010);
+
+  // Once, on the last due tick, and still in phase afterwards.
+  EXPECT_EQ(fired_a, 1);
+  EXPECT_EQ(fired_at - start, 1000000u);
+  EXPECT_EQ(timer_next_deadline_ms(), 10u);
+
+  timer_advance_ms(10);
+  EXPECT_EQ(fired_a, 2);
+  EXPECT_EQ(fired_at - start, 1000020u);
+
+  clear_runnables();
+}
+
+TEST(Timer, AdvanceRunsRunnablesPostedMeanwhile) {
+  setup();
+  uint32_t start = getSysTime();
+
+  post_delayed(&chain_b, nullptr, 30);
+  timer_advance_ms(31);
+  EXPECT_EQ(fired_a, 1);
+  EXPECT_EQ(fired_at - start, 30u);
+  EXPECT_EQ(fired_b, 1);
+  EXPECT_EQ(timer_next_deadline_ms(), UINT32_MAX);
+}
+
+TEST(Timer, AdvanceWithoutRunnables) {
+  setup();
+  uint32_t start = getSysTime();
+
+  EXPECT_EQ(timer_next_deadline_ms(), UINT32_MAX);
+  timer_advance_ms(UINT32_MAX);
+  EXPECT_EQ(getSysTime() - start, UINT32_MAX);
+  timer_advance_ms(0);
+  EXPECT_EQ(getSysTime() - start, UINT32_MAX);
+}
@@ -0,0 +1,192 @@
+extern "C" {
+#include "keepkey/board/messages.h"
+#include "keepkey/board/usb.h"
+#include "keepkey/emulator/emulator.h"
+#include "pb_encode.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+bool msg_write_framed(MessageMapType type, MessageType msg_id,
+                      const pb_field_t *fields, const void *msg);
+}
+
+typedef std::vector<uint8_t> Report;
+
+// Plays the host end of the emulator's main UDP interface.
+static int host_fd = -1;
+
+static void host_setup() {
+  if (host_fd >= 0) return;
+
+  // Let the kernel pick free ports for the emulator to bind.
+  setenv("KEEPKEY_UDP_PORT", "0", 1);
+  emulatorSocketInit();
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(emulatorSocketPort(0));
+  host_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  connect(host_fd, (struct sockaddr *)&addr, sizeof(addr));
+
+  // The emulator replies to whoever wrote last, so say hello first.
+  uint8_t hello[64] = {'?'};
+  send(host_fd, hello, sizeof(hello), 0);
+  ASSERT_TRUE(emulatorSocketWait(1000));
+  int iface;
+  uint8_t buf[64];
+  ASSERT_EQ(emulatorSocketRead(&iface, buf, sizeof(buf)), sizeof(buf));
+}
+
+static std::vector<Report> host_recv() {
+  emulatorSocketFlush();
+
+  std::vector<Report> reports;
+  Report r(64);
+  ssize_t n;
+  while ((n = recv(host_fd, r.data(), r.size(), MSG_DONTWAIT)) > 0) {
+    reports.push_back(Report(r.begin(), r.begin() + n));
+  }
+  return reports;
+}
+
+// What the old TrezorFrameBuffer path put on the wire for this payload.
+static std::vector<Report> framed(uint16_t id, const std::vector<uint8_t> &pb) {
+  std::vector<uint8_t> frame = {'#',
+                                '#',
+                                uint8_t(id >> 8),
+                                uint8_t(id),
+                                uint8_t(pb.size() >> 24),
+                                uint8_t(pb.size() >> 16),
+                                uint8_t(pb.size() >> 8),
+                                uint8_t(pb.size())};
+  frame.insert(frame.end(), pb.begin(), pb.end());
+
+  std::vector<Report> reports;
+  for (size_t pos = 0; pos < frame.size(); pos += 63) {
+    Report r(64, 0);
+    r[0] = '?';
+    size_t n = std::min<size_t>(63, frame.size() - pos);
+    memcpy(&r[1], &frame[pos], n);
+    reports.push_back(r);
+  }
+  return reports;
+}
+
+static std::vector<uint8_t> success_pb(const std::string &text) {
+  std::vector<uint8_t> pb = {0x0a};
+  size_t len = text.size();
+  while (len >= 0x80) {
+    pb.push_back(uint8_t(len | 0x80));
+    len >>= 7;
+  }
+  pb.push_back(uint8_t(len));
+  pb.insert(pb.end(), text.begin(), text.end());
+  return pb;
+}
+
+TEST(USBTX, SingleReport) {
+  host_setup();
+
+  // 1 + 1 + 53 bytes fills the header report exactly.
+  Success msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.has_message = true;
+  std::string text(53, 'a');
+  memcpy(msg.message, text.data(), text.size());
+
+  ASSERT_TRUE(msg_write(MessageType_MessageType_Success, &msg));
+
+  std::vector<Report> reports = host_recv();
+  ASSERT_EQ(reports.size(), 1u);
+  EXPECT_EQ(reports,
+            framed(MessageType_MessageType_Success, success_pb(text)));
+}
+
+TEST(USBTX, MultiReport) {
+  host_setup();
+
+  Success msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.has_message = true;
+  std::string text;
+  for (int i = 0; i < 200; i++) text += char('A' + i % 26);
+  memcpy(msg.message, text.data(), text.size());
+
+  ASSERT_TRUE(msg_write(MessageType_MessageType_Success, &msg));
+
+  // 203 bytes of protobuf: 55 in the header report, then 63 + 63 + 22.
+  std::vector<Report> reports = host_recv();
+  ASSERT_EQ(reports.size(), 4u);
+  EXPECT_EQ(reports,
+            framed(MessageType_MessageType_Success, success_pb(text)));
+  for (int i = 23; i < 64; i++) EXPECT_EQ(reports[3][i], 0) << i;
+}
+
+// A message whose one field sizes at 100 bytes, but fails after writing 40 of
+// them.
+struct Truncated {
+  pb_callback_t data;
+};
+
+static bool truncated_encode(pb_ostream_t *stream, const pb_field_t *field,
+                             void *const *arg) {
+  (void)arg;
+  static const uint8_t bytes[100] = {0};
+  static const uint8_t partial[40] = {'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x'};
+
+  if (!pb_encode_tag_for_field(stream, field)) return false;
+  if (!pb_encode_varint(stream, sizeof(bytes))) return false;
+
+  // No callback means this is pb_get_encoded_size() counting bytes.
+  if (!stream->callback) return pb_write(stream, bytes, sizeof(bytes));
+
+  pb_write(stream, partial, sizeof(partial));
+  return false;
+}
+
+static const pb_field_t Truncated_fields[2] = {
+    PB_FIELD(1, BYTES, REQUIRED, CALLBACK, FIRST, Truncated, data, data, 0),
+    PB_LAST_FIELD};
+
+TEST(USBTX, EncodeFailureZeroFills) {
+  host_setup();
+
+  Truncated msg;
+  msg.data.funcs.encode = truncated_encode;
+  msg.data.arg = NULL;
+
+  EXPECT_FALSE(msg_write_framed(NORMAL_MSG, MessageType_MessageType_Success,
+                                Truncated_fields, &msg));
+
+  // The header still announces all 102 bytes, and the host gets them: what
+  // was encoded, then zeros.
+  std::vector<uint8_t> pb = {0x0a, 100};
+  pb.insert(pb.end(), 8, 'x');
+  pb.insert(pb.end(), 32, 0);
+  pb.resize(102, 0);
+
+  std::vector<Report> reports = host_recv();
+  ASSERT_EQ(reports.size(), 2u);
+  EXPECT_EQ(reports, framed(MessageType_MessageType_Success, pb));
+}
+
+TEST(USBTX, UnknownMessage) {
+  host_setup();
+
+  EXPECT_FALSE(msg_write_framed(NORMAL_MSG, MessageType_MessageType_Success,
+                                NULL, NULL));
+  EXPECT_TRUE(host_recv().empty());
+}
@@ -0,0 +1,67 @@
+extern "C" {
+#include "trezor/crypto/bip32.h"
+#include "trezor/crypto/curves.h"
+#include "trezor/crypto/ecdsa.h"
+#include "trezor/crypto/ed25519-donna/ed25519.h"
+#include "trezor/crypto/secp256k1.h"
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Micro-benchmark for the curve operations that dominate signing. ctest runs
+// a short pass to keep it building and running; for timings run it by hand
+// against a default and a KK_FAST_CRYPTO build:
+// ./crypto-sign-bench [iterations]
+template <typename F>
+static void bench(const char *name, long iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++) {
+    f(i);
+  }
+  auto elapsed = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - start);
+  printf("%-24s %10.1f us/op\n", name, elapsed.count() / iterations);
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000;
+  if (iterations <= 0) return 1;
+
+  uint8_t seed[64];
+  for (size_t i = 0; i < sizeof(seed); i++) seed[i] = i;
+
+  HDNode root;
+  if (hdnode_from_seed(seed, sizeof(seed), SECP256K1_NAME, &root) != 1) {
+    return 1;
+  }
+
+  uint8_t digest[32] = {1};
+  uint8_t sig[64];
+  bench("ecdsa_sign_digest", iterations, [&](long i) {
+    digest[0] = i;
+    ecdsa_sign_digest(&secp256k1, root.private_key, digest, sig, NULL, NULL);
+  });
+
+  bench("hdnode_fill_public_key", iterations, [&](long i) {
+    HDNode node = root;
+    node.private_key[31] ^= i;
+    node.public_key[0] = 0;
+    hdnode_fill_public_key(&node);
+  });
+
+  ed25519_secret_key sk;
+  ed25519_public_key pk;
+  ed25519_signature esig;
+  memcpy(sk, seed, sizeof(sk));
+  ed25519_publickey(sk, pk);
+  bench("ed25519_sign", iterations, [&](long i) {
+    digest[0] = i;
+    ed25519_sign(digest, sizeof(digest), sk, pk, esig);
+  });
+
+  printf("USE_PRECOMPUTED_CP=%d\n", USE_PRECOMPUTED_CP);
+  return 0;
+}
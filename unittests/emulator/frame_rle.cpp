@@ -0,0 +1,112 @@
+#include "frame_rle.h"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+typedef std::vector<uint8_t> Frame;
+
+static Frame encode(const Frame &cur, const Frame *prev) {
+  Frame rec(FRAME_RLE_MAX);
+  size_t len = frame_rle_encode(cur.data(), prev ? prev->data() : nullptr,
+                                rec.data());
+  EXPECT_LE(len, (size_t)FRAME_RLE_MAX);
+  rec.resize(len);
+  return rec;
+}
+
+// Frames that exercise the run/literal boundaries of the encoder.
+static std::vector<Frame> sample_frames() {
+  std::vector<Frame> frames;
+  std::mt19937 rng(1);
+
+  frames.push_back(Frame(FRAME_RLE_PACKED_SIZE, 0));
+  frames.push_back(Frame(FRAME_RLE_PACKED_SIZE, 0xff));
+
+  // No two neighbouring bytes equal: literals all the way.
+  Frame ramp(FRAME_RLE_PACKED_SIZE);
+  for (size_t i = 0; i < ramp.size(); i++) ramp[i] = (uint8_t)i;
+  frames.push_back(ramp);
+
+  Frame noise(FRAME_RLE_PACKED_SIZE);
+  for (auto &b : noise) b = (uint8_t)rng();
+  frames.push_back(noise);
+
+  // Runs of every length around the 3-byte threshold and the 127 cap.
+  Frame runs;
+  for (size_t n = 1; runs.size() < FRAME_RLE_PACKED_SIZE; n = n % 130 + 1) {
+    runs.insert(runs.end(), n, (uint8_t)(runs.size() * 31 + n));
+  }
+  runs.resize(FRAME_RLE_PACKED_SIZE);
+  frames.push_back(runs);
+
+  // A mostly blank screen with a few short strokes, like text.
+  Frame text(FRAME_RLE_PACKED_SIZE, 0);
+  for (int i = 0; i < 40; i++) {
+    size_t at = rng() % (FRAME_RLE_PACKED_SIZE - 8);
+    for (size_t k = 0; k < 1 + rng() % 8; k++) text[at + k] = (uint8_t)rng();
+  }
+  frames.push_back(text);
+
+  return frames;
+}
+
+TEST(FrameRLE, KeyframesRoundTrip) {
+  for (const Frame &frame : sample_frames()) {
+    Frame rec = encode(frame, nullptr);
+    Frame out(FRAME_RLE_PACKED_SIZE, 0x5a);
+    ASSERT_TRUE(frame_rle_apply(out.data(), rec.data(), rec.size(), false));
+    EXPECT_EQ(out, frame);
+  }
+}
+
+TEST(FrameRLE, DeltaChainRoundTrips) {
+  std::vector<Frame> frames = sample_frames();
+
+  // Decode the whole chain the way a host would, starting from a keyframe.
+  Frame host(FRAME_RLE_PACKED_SIZE);
+  Frame rec = encode(frames[0], nullptr);
+  ASSERT_TRUE(frame_rle_apply(host.data(), rec.data(), rec.size(), false));
+
+  for (size_t i = 1; i < frames.size(); i++) {
+    rec = encode(frames[i], &frames[i - 1]);
+    ASSERT_TRUE(frame_rle_apply(host.data(), rec.data(), rec.size(), true));
+    EXPECT_EQ(host, frames[i]) << i;
+  }
+}
+
+TEST(FrameRLE, UnchangedFrameIsTiny) {
+  Frame frame = sample_frames()[3];
+  Frame rec = encode(frame, &frame);
+
+  // 2048 zero bytes: sixteen runs of 127 and one of 16.
+  EXPECT_EQ(rec.size(), 34u);
+
+  Frame host = frame;
+  ASSERT_TRUE(frame_rle_apply(host.data(), rec.data(), rec.size(), true));
+  EXPECT_EQ(host, frame);
+}
+
+TEST(FrameRLE, RejectsMalformedRecords) {
+  Frame frame = sample_frames()[4];
+  Frame rec = encode(frame, nullptr);
+  Frame out(FRAME_RLE_PACKED_SIZE);
+
+  // Truncated anywhere: too short, or cut inside a run or literal block.
+  for (size_t len = 0; len < rec.size(); len++) {
+    EXPECT_FALSE(frame_rle_apply(out.data(), rec.data(), len, false)) << len;
+  }
+
+  // A zero count is never emitted.
+  const uint8_t zero[] = {0, 0};
+  EXPECT_FALSE(frame_rle_apply(out.data(), zero, sizeof(zero), false));
+
+  // Anything decoding past the end of the frame.
+  Frame longer = rec;
+  longer.push_back(3);
+  longer.push_back(0);
+  EXPECT_FALSE(frame_rle_apply(out.data(), longer.data(), longer.size(),
+                               false));
+}
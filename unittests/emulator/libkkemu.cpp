@@ -0,0 +1,486 @@
+#include "keepkey/emulator/libkkemu.h"
+
+extern "C" {
+#include "keepkey/emulator/emulator.h"
+#include "keepkey/transport/interface.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Poll until a whole message comes out of the main interface.
+static bool recv_main(uint16_t *msg_id, std::vector<uint8_t> *payload) {
+  payload->resize(4096);
+  for (int i = 0; i < 100; i++) {
+    size_t len = 0;
+    int ret = kkemu_recv_message(KKEMU_IFACE_MAIN, msg_id, payload->data(),
+                                 payload->size(), &len);
+    if (ret < 0) return false;
+    if (ret == 1) {
+      payload->resize(len);
+      return true;
+    }
+    kkemu_poll_wait(10, nullptr);
+  }
+  return false;
+}
+
+static bool initialize_device() {
+  if (kkemu_send_message(KKEMU_IFACE_MAIN, MessageType_MessageType_Initialize,
+                         nullptr, 0) != 0) {
+    return false;
+  }
+  uint16_t msg_id = 0;
+  std::vector<uint8_t> payload;
+  return recv_main(&msg_id, &payload) &&
+         msg_id == MessageType_MessageType_Features && !payload.empty();
+}
+
+class LibKKEmu : public ::testing::Test {
+ protected:
+  std::vector<uint8_t> flash = std::vector<uint8_t>(KKEMU_FLASH_SIZE, 0xFF);
+
+  // Don't let a failed assertion leave the device running for the next test.
+  void TearDown() override { kkemu_shutdown(); }
+};
+
+TEST_F(LibKKEmu, InitRejectsBadArguments) {
+
+  EXPECT_EQ(kkemu_init(nullptr, KKEMU_FLASH_SIZE), -1);
+  EXPECT_EQ(kkemu_init(flash.data(), KKEMU_FLASH_SIZE - 1), -1);
+  EXPECT_EQ(kkemu_init(flash.data(), 0), -1);
+  EXPECT_FALSE(kkemu_is_running());
+}
+
+TEST_F(LibKKEmu, CallsWhileStopped) {
+  ASSERT_FALSE(kkemu_is_running());
+
+  uint8_t report[KKEMU_PACKET_SIZE] = {'?', '#', '#'};
+  EXPECT_EQ(kkemu_write(report, sizeof(report), KKEMU_IFACE_MAIN), -1);
+  EXPECT_EQ(kkemu_read(report, sizeof(report), KKEMU_IFACE_MAIN), 0);
+  EXPECT_EQ(kkemu_write_many(report, 1, KKEMU_IFACE_MAIN), -1);
+  EXPECT_EQ(kkemu_read_many(report, 1, KKEMU_IFACE_MAIN), -1);
+  EXPECT_EQ(kkemu_send_message(KKEMU_IFACE_MAIN, 0, nullptr, 0), -1);
+  EXPECT_EQ(kkemu_recv_message(KKEMU_IFACE_MAIN, nullptr, nullptr, 0, nullptr),
+            -1);
+  EXPECT_EQ(kkemu_poll(), -1);
+  EXPECT_EQ(kkemu_poll_wait(0, nullptr), -1);
+
+  int width = -1, height = -1;
+  EXPECT_EQ(kkemu_get_display(&width, &height), nullptr);
+  EXPECT_EQ(width, 0);
+  EXPECT_EQ(height, 0);
+
+  uint8_t frame[2048];
+  EXPECT_EQ(kkemu_pop_frame(frame), 0);
+  EXPECT_EQ(kkemu_frames_dropped(), 0u);
+
+  // Harmless without a running emulator.
+  kkemu_set_commit_callback(nullptr, nullptr);
+  kkemu_shutdown();
+  EXPECT_FALSE(kkemu_is_running());
+}
+
+TEST_F(LibKKEmu, OneImplicitDevice) {
+  std::vector<uint8_t> other(KKEMU_FLASH_SIZE, 0xFF);
+
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+  EXPECT_TRUE(kkemu_is_running());
+
+  // Further devices come from kkemu_create().
+  EXPECT_EQ(kkemu_init(other.data(), other.size()), -1);
+  EXPECT_EQ(kkemu_init(flash.data(), flash.size()), -1);
+
+  // The refused calls left the running device alone.
+  EXPECT_TRUE(initialize_device());
+
+  kkemu_shutdown();
+  EXPECT_FALSE(kkemu_is_running());
+  kkemu_shutdown();
+  EXPECT_FALSE(kkemu_is_running());
+}
+
+// Send Initialize to a handle and return the Features it answers with.
+static std::vector<uint8_t> features(kkemu_ctx *ctx) {
+  std::vector<uint8_t> payload(4096);
+  if (kkemu_ctx_send_message(ctx, KKEMU_IFACE_MAIN,
+                             MessageType_MessageType_Initialize, nullptr,
+                             0) != 0) {
+    return {};
+  }
+  for (int i = 0; i < 100; i++) {
+    uint16_t msg_id = 0;
+    size_t len = 0;
+    int ret = kkemu_ctx_recv_message(ctx, KKEMU_IFACE_MAIN, &msg_id,
+                                     payload.data(), payload.size(), &len);
+    if (ret < 0) return {};
+    if (ret == 1) {
+      if (msg_id != MessageType_MessageType_Features) return {};
+      payload.resize(len);
+      return payload;
+    }
+    kkemu_ctx_poll_wait(ctx, 10, nullptr);
+  }
+  return {};
+}
+
+TEST_F(LibKKEmu, HandlesKeepTheirOwnState) {
+  std::vector<uint8_t> other(KKEMU_FLASH_SIZE, 0xFF);
+
+  kkemu_ctx *first = kkemu_create(flash.data(), flash.size());
+  kkemu_ctx *second = kkemu_create(other.data(), other.size());
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(kkemu_create(nullptr, KKEMU_FLASH_SIZE), nullptr);
+
+  // Each erased device set itself up with its own random device id.
+  std::vector<uint8_t> first_features = features(first);
+  std::vector<uint8_t> second_features = features(second);
+  ASSERT_FALSE(first_features.empty());
+  ASSERT_FALSE(second_features.empty());
+  EXPECT_NE(first_features, second_features);
+
+  // Running one device leaves the other's storage and flash alone.
+  std::vector<uint8_t> snapshot = other;
+  EXPECT_EQ(features(first), first_features);
+  EXPECT_EQ(other, snapshot);
+  EXPECT_EQ(features(second), second_features);
+
+  // The single-device API runs alongside.
+  std::vector<uint8_t> third(KKEMU_FLASH_SIZE, 0xFF);
+  ASSERT_EQ(kkemu_init(third.data(), third.size()), 0);
+  EXPECT_TRUE(initialize_device());
+  EXPECT_EQ(features(first), first_features);
+
+  // A device comes back from its flash buffer as it was.
+  kkemu_destroy(first);
+  first = kkemu_create(flash.data(), flash.size());
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(features(first), first_features);
+  EXPECT_EQ(features(second), second_features);
+
+  kkemu_destroy(first);
+  kkemu_destroy(second);
+  kkemu_destroy(nullptr);
+}
+
+TEST_F(LibKKEmu, HandlesOnSeveralThreads) {
+  std::vector<std::vector<uint8_t>> flashes(
+      4, std::vector<uint8_t>(KKEMU_FLASH_SIZE, 0xFF));
+  std::vector<int> answered(flashes.size());
+
+  std::vector<std::thread> hosts;
+  for (size_t i = 0; i < flashes.size(); i++) {
+    hosts.emplace_back([&, i] {
+      kkemu_ctx *ctx = kkemu_create(flashes[i].data(), flashes[i].size());
+      if (!ctx) return;
+      std::vector<uint8_t> expected = features(ctx);
+      for (int n = 0; n < 20 && !expected.empty(); n++) {
+        if (features(ctx) == expected) answered[i]++;
+      }
+      kkemu_destroy(ctx);
+    });
+  }
+  for (auto &host : hosts) host.join();
+
+  for (int n : answered) EXPECT_EQ(n, 20);
+}
+
+TEST_F(LibKKEmu, ReinitFromSameFlash) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+  ASSERT_TRUE(initialize_device());
+  kkemu_shutdown();
+
+  // The final flush wrote storage, and is still reported after shutdown.
+  kkemu_flash_range ranges[4];
+  EXPECT_GT(kkemu_get_dirty_ranges(ranges, 4), 0);
+  kkemu_clear_dirty();
+  EXPECT_EQ(kkemu_get_dirty_ranges(ranges, 4), 0);
+
+  // Nothing queued before the shutdown survives it.
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+  uint8_t report[KKEMU_PACKET_SIZE];
+  EXPECT_EQ(kkemu_read(report, sizeof(report), KKEMU_IFACE_MAIN), 0);
+  EXPECT_EQ(kkemu_frames_dropped(), 0u);
+
+  int width = 0, height = 0;
+  EXPECT_NE(kkemu_get_display(&width, &height), nullptr);
+  EXPECT_EQ(width, 256);
+  EXPECT_EQ(height, 64);
+
+  EXPECT_TRUE(initialize_device());
+}
+
+TEST_F(LibKKEmu, ReinitFromOtherFlash) {
+  std::vector<uint8_t> first(KKEMU_FLASH_SIZE, 0xFF);
+  std::vector<uint8_t> second(KKEMU_FLASH_SIZE, 0xFF);
+
+  ASSERT_EQ(kkemu_init(first.data(), first.size()), 0);
+  kkemu_shutdown();
+  std::vector<uint8_t> snapshot = first;
+
+  ASSERT_EQ(kkemu_init(second.data(), second.size()), 0);
+  EXPECT_TRUE(initialize_device());
+  kkemu_shutdown();
+
+  // The second device never wrote through to the first one's buffer.
+  EXPECT_EQ(first, snapshot);
+}
+
+TEST_F(LibKKEmu, PollWaitIdles) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  // Returns with nothing to do, whether asked to sleep or not. The bounds
+  // leave room for a busy machine: they only catch a wait that never ends.
+  int next = -2;
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(kkemu_poll_wait(0, &next), 0);
+  EXPECT_GE(next, -1);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(10));
+
+  start = std::chrono::steady_clock::now();
+  EXPECT_EQ(kkemu_poll_wait(50, &next), 0);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(10));
+  EXPECT_GE(next, -1);
+}
+
+TEST_F(LibKKEmu, PollWaitWakesOnInput) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  std::thread host([] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    kkemu_send_message(KKEMU_IFACE_MAIN, MessageType_MessageType_Initialize,
+                       nullptr, 0);
+  });
+
+  // Timer deadlines may end a wait early, but input must end it well
+  // before the host's timeout.
+  auto start = std::chrono::steady_clock::now();
+  int worked = 0;
+  while (!worked &&
+         std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+    worked = kkemu_poll_wait(10000, nullptr);
+  }
+  EXPECT_EQ(worked, 1);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  host.join();
+
+  // The whole multi-report reply was produced in that one call.
+  uint16_t msg_id = 0;
+  std::vector<uint8_t> payload(4096);
+  size_t len = 0;
+  EXPECT_EQ(kkemu_recv_message(KKEMU_IFACE_MAIN, &msg_id, payload.data(),
+                               payload.size(), &len),
+            1);
+  EXPECT_EQ(msg_id, MessageType_MessageType_Features);
+}
+
+// Write a '?##' frame to the main interface the way the firmware does, one
+// report at a time.
+static void emit_frame(uint16_t msg_id, const std::vector<uint8_t> &payload,
+                       uint32_t announced) {
+  uint8_t report[KKEMU_PACKET_SIZE] = {'?',
+                                       '#',
+                                       '#',
+                                       (uint8_t)(msg_id >> 8),
+                                       (uint8_t)msg_id,
+                                       (uint8_t)(announced >> 24),
+                                       (uint8_t)(announced >> 16),
+                                       (uint8_t)(announced >> 8),
+                                       (uint8_t)announced};
+  size_t pos = 9, off = 0;
+  do {
+    size_t n = std::min(payload.size() - off, sizeof(report) - pos);
+    memcpy(report + pos, payload.data() + off, n);
+    memset(report + pos + n, 0, sizeof(report) - pos - n);
+    off += n;
+    emulatorSocketWrite(0, report, sizeof(report));
+    pos = 1;
+  } while (off < payload.size());
+}
+
+static void emit_frame(uint16_t msg_id, const std::vector<uint8_t> &payload) {
+  emit_frame(msg_id, payload, payload.size());
+}
+
+// Continuation reports of this payload all begin with "?##".
+static std::vector<uint8_t> hashes_payload(size_t len) {
+  std::vector<uint8_t> payload(len);
+  for (size_t i = 0; i < len; i++) {
+    payload[i] = (i >= 55 && (i - 55) % 63 < 2) ? '#' : (uint8_t)i;
+  }
+  return payload;
+}
+
+static int recv(uint16_t *msg_id, std::vector<uint8_t> *payload,
+                size_t *msg_len) {
+  payload->resize(KKEMU_MESSAGE_MAX);
+  int ret = kkemu_recv_message(KKEMU_IFACE_MAIN, msg_id, payload->data(),
+                               payload->size(), msg_len);
+  payload->resize(ret == 1 ? *msg_len : 0);
+  return ret;
+}
+
+TEST_F(LibKKEmu, RecvMessageIgnoresPayload) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  // Payload that looks like frame headers must not split the message.
+  std::vector<uint8_t> first = hashes_payload(1000);
+  std::vector<uint8_t> second = hashes_payload(200);
+  emit_frame(17, first);
+  emit_frame(18, second);
+
+  uint16_t msg_id = 0;
+  size_t len = 0;
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(msg_id, 17);
+  EXPECT_EQ(payload, first);
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(msg_id, 18);
+  EXPECT_EQ(payload, second);
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 0);
+}
+
+TEST_F(LibKKEmu, RecvMessageSkipsFrameBegunByRead) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  std::vector<uint8_t> second = hashes_payload(300);
+  emit_frame(17, hashes_payload(500));
+  emit_frame(18, second);
+
+  uint8_t report[KKEMU_PACKET_SIZE];
+  ASSERT_EQ(kkemu_read(report, sizeof(report), KKEMU_IFACE_MAIN),
+            KKEMU_PACKET_SIZE);
+  ASSERT_EQ(kkemu_read(report, sizeof(report), KKEMU_IFACE_MAIN),
+            KKEMU_PACKET_SIZE);
+
+  uint16_t msg_id = 0;
+  size_t len = 0;
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(msg_id, 18);
+  EXPECT_EQ(payload, second);
+}
+
+TEST_F(LibKKEmu, RecvMessageReportsOversize) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  std::vector<uint8_t> small = {1, 2, 3};
+  emit_frame(17, hashes_payload(KKEMU_MESSAGE_MAX + 1));
+  emit_frame(18, small);
+
+  uint16_t msg_id = 0;
+  size_t len = 0;
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(recv(&msg_id, &payload, &len), -2);
+  EXPECT_EQ(msg_id, 17);
+  EXPECT_EQ(len, (size_t)KKEMU_MESSAGE_MAX + 1);
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(msg_id, 18);
+  EXPECT_EQ(payload, small);
+
+  // The largest message that fits still goes through whole.
+  std::vector<uint8_t> largest = hashes_payload(KKEMU_MESSAGE_MAX);
+  emit_frame(19, largest);
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(msg_id, 19);
+  EXPECT_EQ(payload, largest);
+}
+
+TEST_F(LibKKEmu, RecvMessageReportsQueueFull) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  // The host isn't reading: 120 one-report messages, then one of ten
+  // reports that no longer fits, then one that does.
+  for (int i = 0; i < 120; i++) {
+    emit_frame(17, {(uint8_t)i});
+  }
+  emit_frame(18, hashes_payload(600));
+  emit_frame(19, {42});
+
+  uint16_t msg_id = 0;
+  size_t len = 0;
+  std::vector<uint8_t> payload;
+  for (int i = 0; i < 120; i++) {
+    ASSERT_EQ(recv(&msg_id, &payload, &len), 1);
+    EXPECT_EQ(payload, std::vector<uint8_t>{(uint8_t)i});
+  }
+  EXPECT_EQ(recv(&msg_id, &payload, &len), -2);
+  EXPECT_EQ(msg_id, 18);
+  EXPECT_EQ(len, (size_t)UINT32_MAX);
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(msg_id, 19);
+  EXPECT_EQ(payload, std::vector<uint8_t>{42});
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 0);
+}
+
+TEST_F(LibKKEmu, RecvMessageBufferTooSmall) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  std::vector<uint8_t> message = hashes_payload(100);
+  emit_frame(17, message);
+
+  uint16_t msg_id = 0;
+  size_t len = 0;
+  uint8_t small[10];
+  EXPECT_EQ(kkemu_recv_message(KKEMU_IFACE_MAIN, &msg_id, small,
+                               sizeof(small), &len),
+            -1);
+  EXPECT_EQ(len, message.size());
+
+  // Still queued for a retry.
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(recv(&msg_id, &payload, &len), 1);
+  EXPECT_EQ(payload, message);
+}
+
+TEST_F(LibKKEmu, SendMessageRejectsOversize) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  std::vector<uint8_t> payload(KKEMU_MESSAGE_MAX + 1);
+  EXPECT_EQ(kkemu_send_message(KKEMU_IFACE_DEBUG, 17, payload.data(),
+                               payload.size()),
+            -1);
+  EXPECT_EQ(kkemu_send_message(KKEMU_IFACE_DEBUG, 17, payload.data(),
+                               KKEMU_MESSAGE_MAX),
+            0);
+}
+
+TEST_F(LibKKEmu, FrameStreamRawAndDecodedAgree) {
+  ASSERT_EQ(kkemu_init(flash.data(), flash.size()), 0);
+
+  // Alternate between raw records, decoded here, and decoded frames, so each
+  // call sees records the other one consumed.
+  uint8_t mirror[2048] = {};
+  std::vector<uint8_t> rec(KKEMU_FRAME_RLE_MAX);
+  int frames = 0;
+  for (int i = 0; i < 50; i++) {
+    kkemu_poll_wait(10, nullptr);
+    for (;;) {
+      if (frames % 2 == 0) {
+        int kind = -1;
+        int len = kkemu_pop_frame_rle(rec.data(), rec.size(), &kind);
+        ASSERT_GE(len, 0);
+        if (len == 0) break;
+        ASSERT_EQ(kkemu_frame_apply(mirror, rec.data(), len, kind), 0);
+      } else {
+        uint8_t frame[2048];
+        if (!kkemu_pop_frame(frame)) break;
+        memcpy(mirror, frame, sizeof(frame));
+      }
+      frames++;
+    }
+  }
+
+  ASSERT_GT(frames, 0);
+  EXPECT_EQ(kkemu_frames_dropped(), 0u);
+  EXPECT_EQ(memcmp(mirror, kkemu_get_display(nullptr, nullptr), 2048), 0);
+}
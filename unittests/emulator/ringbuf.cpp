@@ -0,0 +1,194 @@
+#include "ringbuf.h"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// A report whose every byte identifies it.
+static void fill(uint8_t *report, uint32_t seq) {
+  for (int i = 0; i < RINGBUF_SLOT_SIZE; i++) {
+    report[i] = (uint8_t)(seq * 7 + i);
+  }
+}
+
+static bool matches(const uint8_t *report, uint32_t seq) {
+  uint8_t expected[RINGBUF_SLOT_SIZE];
+  fill(expected, seq);
+  return memcmp(report, expected, RINGBUF_SLOT_SIZE) == 0;
+}
+
+static std::unique_ptr<RingBuf> make_ring() {
+  std::unique_ptr<RingBuf> rb(new RingBuf);
+  ringbuf_init(rb.get());
+  return rb;
+}
+
+// Push and pop single reports until head and tail sit at `pos`.
+static void move_to(RingBuf *rb, size_t pos) {
+  uint8_t report[RINGBUF_SLOT_SIZE] = {};
+  for (size_t i = 0; i < pos; i++) {
+    ASSERT_TRUE(ringbuf_push(rb, report, sizeof(report)));
+    ASSERT_TRUE(ringbuf_pop(rb, report, sizeof(report)));
+  }
+  ASSERT_TRUE(ringbuf_empty(rb));
+}
+
+TEST(RingBuf, PushPop) {
+  auto rb = make_ring();
+  uint8_t report[RINGBUF_SLOT_SIZE];
+
+  EXPECT_TRUE(ringbuf_empty(rb.get()));
+  EXPECT_FALSE(ringbuf_pop(rb.get(), report, sizeof(report)));
+
+  // Short reports are zero padded.
+  const uint8_t msg[3] = {'?', '#', '#'};
+  ASSERT_TRUE(ringbuf_push(rb.get(), msg, sizeof(msg)));
+  EXPECT_FALSE(ringbuf_empty(rb.get()));
+  ASSERT_TRUE(ringbuf_pop(rb.get(), report, sizeof(report)));
+  EXPECT_EQ(memcmp(report, msg, sizeof(msg)), 0);
+  for (size_t i = sizeof(msg); i < sizeof(report); i++) {
+    EXPECT_EQ(report[i], 0);
+  }
+
+  uint8_t big[RINGBUF_SLOT_SIZE + 1] = {};
+  EXPECT_FALSE(ringbuf_push(rb.get(), big, sizeof(big)));
+  EXPECT_TRUE(ringbuf_empty(rb.get()));
+}
+
+TEST(RingBuf, HoldsCapacityMinusOne) {
+  auto rb = make_ring();
+  uint8_t report[RINGBUF_SLOT_SIZE];
+
+  for (uint32_t i = 0; i < RINGBUF_CAPACITY - 1; i++) {
+    fill(report, i);
+    ASSERT_TRUE(ringbuf_push(rb.get(), report, sizeof(report)));
+  }
+  EXPECT_EQ(ringbuf_space(rb.get()), 0u);
+  EXPECT_EQ(ringbuf_count(rb.get()), (size_t)RINGBUF_CAPACITY - 1);
+  EXPECT_FALSE(ringbuf_push(rb.get(), report, sizeof(report)));
+
+  for (uint32_t i = 0; i < RINGBUF_CAPACITY - 1; i++) {
+    ASSERT_TRUE(ringbuf_pop(rb.get(), report, sizeof(report)));
+    EXPECT_TRUE(matches(report, i)) << i;
+  }
+  EXPECT_TRUE(ringbuf_empty(rb.get()));
+}
+
+TEST(RingBuf, ManyWrapsAround) {
+  // Batches starting a few slots and one slot short of the end of the
+  // array are copied in two runs; one starting at 0 in a single run.
+  const size_t starts[] = {RINGBUF_CAPACITY - 3, RINGBUF_CAPACITY - 1, 0};
+  for (size_t start : starts) {
+    auto rb = make_ring();
+    move_to(rb.get(), start);
+
+    const size_t count = 10;
+    std::vector<uint8_t> in(count * RINGBUF_SLOT_SIZE);
+    for (uint32_t i = 0; i < count; i++) {
+      fill(&in[i * RINGBUF_SLOT_SIZE], i);
+    }
+    ASSERT_EQ(ringbuf_push_many(rb.get(), in.data(), count), count);
+    EXPECT_EQ(ringbuf_count(rb.get()), count);
+
+    std::vector<uint8_t> out(count * RINGBUF_SLOT_SIZE);
+    ASSERT_EQ(ringbuf_pop_many(rb.get(), out.data(), count), count);
+    EXPECT_EQ(in, out) << "start " << start;
+    EXPECT_TRUE(ringbuf_empty(rb.get()));
+  }
+}
+
+TEST(RingBuf, ManyClampsToSpaceAndCount) {
+  auto rb = make_ring();
+  move_to(rb.get(), RINGBUF_CAPACITY / 2);
+
+  std::vector<uint8_t> in(RINGBUF_CAPACITY * RINGBUF_SLOT_SIZE);
+  for (uint32_t i = 0; i < RINGBUF_CAPACITY; i++) {
+    fill(&in[i * RINGBUF_SLOT_SIZE], i);
+  }
+
+  // Only as many as fit; the rest is left to the caller.
+  EXPECT_EQ(ringbuf_push_many(rb.get(), in.data(), RINGBUF_CAPACITY),
+            (size_t)RINGBUF_CAPACITY - 1);
+  EXPECT_EQ(ringbuf_push_many(rb.get(), in.data(), 1), 0u);
+
+  std::vector<uint8_t> out(RINGBUF_CAPACITY * RINGBUF_SLOT_SIZE);
+  EXPECT_EQ(ringbuf_pop_many(rb.get(), out.data(), 5), 5u);
+  EXPECT_EQ(ringbuf_pop_many(rb.get(), out.data() + 5 * RINGBUF_SLOT_SIZE,
+                             RINGBUF_CAPACITY),
+            (size_t)RINGBUF_CAPACITY - 1 - 5);
+  for (uint32_t i = 0; i < RINGBUF_CAPACITY - 1; i++) {
+    EXPECT_TRUE(matches(&out[i * RINGBUF_SLOT_SIZE], i)) << i;
+  }
+
+  EXPECT_EQ(ringbuf_pop_many(rb.get(), out.data(), 1), 0u);
+  EXPECT_EQ(ringbuf_push_many(rb.get(), in.data(), 0), 0u);
+}
+
+TEST(RingBuf, SlotsWrapAround) {
+  auto rb = make_ring();
+  move_to(rb.get(), RINGBUF_CAPACITY - 2);
+
+  // Fill slots across the end of the array; none is visible until commit.
+  const size_t count = 6;
+  ASSERT_GE(ringbuf_space(rb.get()), count);
+  for (uint32_t i = 0; i < count; i++) {
+    fill(ringbuf_write_slot(rb.get(), i), i);
+  }
+  EXPECT_EQ(ringbuf_count(rb.get()), 0u);
+  ringbuf_commit(rb.get(), count);
+  EXPECT_EQ(ringbuf_count(rb.get()), count);
+  EXPECT_EQ(ringbuf_space(rb.get()), RINGBUF_CAPACITY - 1 - count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    EXPECT_TRUE(matches(ringbuf_read_slot(rb.get(), i), i)) << i;
+  }
+  ringbuf_consume(rb.get(), 4);
+  EXPECT_EQ(ringbuf_count(rb.get()), 2u);
+  EXPECT_TRUE(matches(ringbuf_read_slot(rb.get(), 0), 4));
+
+  // Single-report pops see the same order.
+  uint8_t report[RINGBUF_SLOT_SIZE];
+  ASSERT_TRUE(ringbuf_pop(rb.get(), report, sizeof(report)));
+  EXPECT_TRUE(matches(report, 4));
+  ringbuf_consume(rb.get(), 1);
+  EXPECT_TRUE(ringbuf_empty(rb.get()));
+}
+
+TEST(RingBuf, ProducerConsumerThreads) {
+  auto rb = make_ring();
+  const uint32_t total = 100000;
+
+  std::thread producer([&] {
+    uint8_t batch[7 * RINGBUF_SLOT_SIZE];
+    uint32_t seq = 0;
+    while (seq < total) {
+      size_t n = 1 + seq % 7;
+      if (n > total - seq) n = total - seq;
+      for (size_t i = 0; i < n; i++) {
+        fill(&batch[i * RINGBUF_SLOT_SIZE], seq + i);
+      }
+      size_t pushed = ringbuf_push_many(rb.get(), batch, n);
+      if (!pushed) std::this_thread::yield();
+      seq += pushed;
+    }
+  });
+
+  uint8_t batch[5 * RINGBUF_SLOT_SIZE];
+  uint32_t seq = 0;
+  bool in_order = true;
+  while (seq < total) {
+    size_t n = ringbuf_pop_many(rb.get(), batch, 1 + seq % 5);
+    for (size_t i = 0; i < n; i++) {
+      in_order &= matches(&batch[i * RINGBUF_SLOT_SIZE], seq + i);
+    }
+    if (!n) std::this_thread::yield();
+    seq += n;
+  }
+  producer.join();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_TRUE(ringbuf_empty(rb.get()));
+}
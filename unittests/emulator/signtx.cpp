@@ -0,0 +1,553 @@
+#include "keepkey/emulator/libkkemu.h"
+
+extern "C" {
+#include "keepkey/transport/interface.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "trezor/crypto/bip32.h"
+#include "trezor/crypto/bip39.h"
+#include "trezor/crypto/curves.h"
+#include "trezor/crypto/ecdsa.h"
+#include "trezor/crypto/hasher.h"
+#include "trezor/crypto/secp256k1.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if DEBUG_LINK
+
+typedef std::vector<uint8_t> Bytes;
+
+static const char *const MNEMONIC =
+    "all all all all all all all all all all all all";
+
+static const uint32_t HARDENED = 0x80000000;
+
+// Runs the firmware on its own thread, so the test can answer the
+// confirmation dialogs the firmware waits in.
+class Device {
+ public:
+  Device() : flash(KKEMU_FLASH_SIZE, 0xFF) {
+    ctx = kkemu_create(flash.data(), flash.size());
+    if (ctx) poller = std::thread([this] { poll(); });
+  }
+
+  ~Device() {
+    stop = true;
+    if (poller.joinable()) poller.join();
+    kkemu_destroy(ctx);
+  }
+
+  // Send a message and return the first reply that isn't a ButtonRequest.
+  // Every ButtonRequest is confirmed through the debug link.
+  bool call(uint16_t msg_id, const pb_field_t *fields, const void *msg,
+            uint16_t *reply_id, Bytes *reply) {
+    return send(KKEMU_IFACE_MAIN, msg_id, fields, msg) && recv(reply_id, reply);
+  }
+
+  bool send(int iface, uint16_t msg_id, const pb_field_t *fields,
+            const void *msg) {
+    Bytes payload(KKEMU_MESSAGE_MAX);
+    pb_ostream_t stream =
+        pb_ostream_from_buffer(payload.data(), payload.size());
+    if (fields && !pb_encode(&stream, fields, msg)) return false;
+    return kkemu_ctx_send_message(ctx, iface, msg_id, payload.data(),
+                                  stream.bytes_written) == 0;
+  }
+
+  bool recv(uint16_t *reply_id, Bytes *reply) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (std::chrono::steady_clock::now() < deadline) {
+      reply->resize(KKEMU_MESSAGE_MAX);
+      size_t len = 0;
+      int ret = kkemu_ctx_recv_message(ctx, KKEMU_IFACE_MAIN, reply_id,
+                                       reply->data(), reply->size(), &len);
+      if (ret < 0) return false;
+      if (ret == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      reply->resize(len);
+      if (*reply_id != MessageType_MessageType_ButtonRequest) return true;
+
+      // ButtonAck, then DebugLinkDecision { yes_no: true }
+      static const uint8_t yes[] = {0x08, 0x01};
+      if (kkemu_ctx_send_message(ctx, KKEMU_IFACE_MAIN,
+                                 MessageType_MessageType_ButtonAck, nullptr,
+                                 0) != 0 ||
+          kkemu_ctx_send_message(ctx, KKEMU_IFACE_DEBUG,
+                                 MessageType_MessageType_DebugLinkDecision,
+                                 yes, sizeof(yes)) != 0) {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  kkemu_ctx *ctx;
+
+ private:
+  void poll() {
+    while (!stop) kkemu_ctx_poll_wait(ctx, 10, nullptr);
+  }
+
+  std::vector<uint8_t> flash;
+  std::thread poller;
+  std::atomic<bool> stop{false};
+};
+
+static void sha256d(const Bytes &data, uint8_t hash[32]) {
+  Hasher hasher;
+  hasher_Init(&hasher, HASHER_SHA2D);
+  hasher_Update(&hasher, data.data(), data.size());
+  hasher_Final(&hasher, hash);
+}
+
+static void put_u32(Bytes *out, uint32_t v) {
+  for (int i = 0; i < 4; i++) out->push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void put_u64(Bytes *out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out->push_back((uint8_t)(v >> (8 * i)));
+}
+
+static Bytes p2pkh(const uint8_t pubkeyhash[20]) {
+  Bytes script = {0x76, 0xa9, 0x14};
+  script.insert(script.end(), pubkeyhash, pubkeyhash + 20);
+  script.push_back(0x88);
+  script.push_back(0xac);
+  return script;
+}
+
+// m/44'/0'/0'/change/index on the test seed
+static HDNode derive(uint32_t change, uint32_t index) {
+  uint8_t seed[64];
+  mnemonic_to_seed(MNEMONIC, "", seed, nullptr);
+  HDNode node;
+  hdnode_from_seed(seed, sizeof(seed), SECP256K1_NAME, &node);
+  hdnode_private_ckd(&node, HARDENED | 44);
+  hdnode_private_ckd(&node, HARDENED | 0);
+  hdnode_private_ckd(&node, HARDENED | 0);
+  hdnode_private_ckd(&node, change);
+  hdnode_private_ckd(&node, index);
+  hdnode_fill_public_key(&node);
+  return node;
+}
+
+// Reads a serialized legacy transaction back, one field at a time.
+struct Reader {
+  const Bytes &tx;
+  size_t pos;
+
+  bool take(size_t n, const uint8_t **p) {
+    if (tx.size() - pos < n) return false;
+    *p = tx.data() + pos;
+    pos += n;
+    return true;
+  }
+
+  // Only the single byte form occurs in the test transaction.
+  bool varint(size_t *v) {
+    const uint8_t *p;
+    if (!take(1, &p) || *p >= 0xfd) return false;
+    *v = *p;
+    return true;
+  }
+};
+
+// The 64 byte r || s form of a DER signature.
+static bool der_to_sig(const uint8_t *der, size_t len, uint8_t sig[64]) {
+  if (len < 8 || der[0] != 0x30 || der[1] != len - 2) return false;
+  size_t pos = 2;
+  for (int part = 0; part < 2; part++) {
+    if (pos + 2 > len || der[pos] != 0x02) return false;
+    size_t n = der[pos + 1];
+    pos += 2;
+    if (pos + n > len) return false;
+    const uint8_t *v = der + pos;
+    while (n > 32 && *v == 0) {
+      v++;
+      n--;
+    }
+    if (n > 32) return false;
+    memset(sig + part * 32, 0, 32 - n);
+    memcpy(sig + part * 32 + 32 - n, v, n);
+    pos += der[pos - 1];
+  }
+  return pos == len;
+}
+
+// Plays the wallet for a legacy P2PKH transaction spending both outputs of
+// one previous transaction to a change output and an external output.
+struct Wallet {
+  HDNode inputs[2] = {derive(0, 0), derive(0, 1)};
+  uint8_t pubkeyhash[2][20];
+  Bytes prev_tx;
+  uint8_t prev_hash[32];  // as the protocol carries it, byte reversed
+
+  Bytes serialized;
+  uint32_t signatures = 0;
+  uint32_t output_requests = 0;
+
+  Wallet() {
+    for (int i = 0; i < 2; i++) {
+      ecdsa_get_pubkeyhash(inputs[i].public_key, HASHER_SHA2_RIPEMD,
+                           pubkeyhash[i]);
+    }
+
+    // version, one input, two outputs of 50000, lock_time
+    put_u32(&prev_tx, 1);
+    prev_tx.push_back(1);
+    prev_tx.insert(prev_tx.end(), 32, 0x11);
+    put_u32(&prev_tx, 0);
+    prev_tx.push_back(0);
+    put_u32(&prev_tx, 0xffffffff);
+    prev_tx.push_back(2);
+    for (int i = 0; i < 2; i++) {
+      put_u64(&prev_tx, 50000);
+      Bytes script = p2pkh(pubkeyhash[i]);
+      prev_tx.push_back((uint8_t)script.size());
+      prev_tx.insert(prev_tx.end(), script.begin(), script.end());
+    }
+    put_u32(&prev_tx, 0);
+
+    sha256d(prev_tx, prev_hash);
+    std::reverse(prev_hash, prev_hash + 32);
+  }
+
+  static void set_path(uint32_t *address_n, pb_size_t *count,
+                       uint32_t change, uint32_t index) {
+    const uint32_t path[] = {HARDENED | 44, HARDENED | 0, HARDENED | 0, change,
+                             index};
+    memcpy(address_n, path, sizeof(path));
+    *count = 5;
+  }
+
+  // The TxAck that answers req.
+  bool answer(const TxRequest &req, TxAck *ack) {
+    memset(ack, 0, sizeof(*ack));
+    ack->has_tx = true;
+    TransactionType &tx = ack->tx;
+    bool prev = req.has_details && req.details.has_tx_hash;
+    uint32_t index = req.details.request_index;
+
+    if (prev && (req.details.tx_hash.size != 32 ||
+                 memcmp(req.details.tx_hash.bytes, prev_hash, 32) != 0)) {
+      return false;
+    }
+
+    switch (req.request_type) {
+      case RequestType_TXMETA:
+        tx.has_version = true;
+        tx.version = 1;
+        tx.has_lock_time = true;
+        tx.lock_time = 0;
+        tx.has_inputs_cnt = true;
+        tx.inputs_cnt = 1;
+        tx.has_outputs_cnt = true;
+        tx.outputs_cnt = 2;
+        return true;
+
+      case RequestType_TXINPUT:
+        tx.inputs_count = 1;
+        tx.inputs[0].prev_hash.size = 32;
+        tx.inputs[0].has_sequence = true;
+        tx.inputs[0].sequence = 0xffffffff;
+        if (prev) {
+          memset(tx.inputs[0].prev_hash.bytes, 0x11, 32);
+          tx.inputs[0].prev_index = 0;
+          tx.inputs[0].has_script_sig = true;
+          tx.inputs[0].script_sig.size = 0;
+        } else {
+          if (index > 1) return false;
+          memcpy(tx.inputs[0].prev_hash.bytes, prev_hash, 32);
+          tx.inputs[0].prev_index = index;
+          tx.inputs[0].has_script_type = true;
+          tx.inputs[0].script_type = InputScriptType_SPENDADDRESS;
+          set_path(tx.inputs[0].address_n, &tx.inputs[0].address_n_count, 0,
+                   index);
+        }
+        return true;
+
+      case RequestType_TXOUTPUT:
+        if (index > 1) return false;
+        if (prev) {
+          Bytes script = p2pkh(pubkeyhash[index]);
+          tx.bin_outputs_count = 1;
+          tx.bin_outputs[0].amount = 50000;
+          tx.bin_outputs[0].script_pubkey.size = script.size();
+          memcpy(tx.bin_outputs[0].script_pubkey.bytes, script.data(),
+                 script.size());
+        } else {
+          // Change first, then one to another of our addresses, which is
+          // not change and is confirmed like any external output.
+          output_requests++;
+          tx.outputs_count = 1;
+          tx.outputs[0].amount = index == 0 ? 60000 : 30000;
+          tx.outputs[0].script_type = OutputScriptType_PAYTOADDRESS;
+          set_path(tx.outputs[0].address_n, &tx.outputs[0].address_n_count,
+                   index == 0 ? 1 : 0, index == 0 ? 0 : 2);
+        }
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  void collect(const TxRequest &req) {
+    if (!req.has_serialized) return;
+    if (req.serialized.has_signature_index) signatures++;
+    if (req.serialized.has_serialized_tx) {
+      serialized.insert(
+          serialized.end(), req.serialized.serialized_tx.bytes,
+          req.serialized.serialized_tx.bytes +
+              req.serialized.serialized_tx.size);
+    }
+  }
+};
+
+TEST(SignTx, LegacyFromOutputsCache) {
+  Device device;
+  ASSERT_NE(device.ctx, nullptr);
+
+  uint16_t msg_id = 0;
+  Bytes reply;
+
+  LoadDevice load;
+  memset(&load, 0, sizeof(load));
+  load.has_mnemonic = true;
+  strncpy(load.mnemonic, MNEMONIC, sizeof(load.mnemonic) - 1);
+  load.has_skip_checksum = true;
+  load.skip_checksum = true;
+  ASSERT_TRUE(device.call(MessageType_MessageType_LoadDevice, LoadDevice_fields,
+                          &load, &msg_id, &reply));
+  ASSERT_EQ(msg_id, MessageType_MessageType_Success);
+
+  SignTx sign;
+  memset(&sign, 0, sizeof(sign));
+  sign.inputs_count = 2;
+  sign.outputs_count = 2;
+  sign.has_coin_name = true;
+  strncpy(sign.coin_name, "Bitcoin", sizeof(sign.coin_name) - 1);
+
+  Wallet wallet;
+  const pb_field_t *fields = SignTx_fields;
+  const void *msg = &sign;
+  uint16_t send_id = MessageType_MessageType_SignTx;
+  TxAck ack;
+  for (int round = 0; round < 100; round++) {
+    ASSERT_TRUE(device.call(send_id, fields, msg, &msg_id, &reply));
+    ASSERT_EQ(msg_id, MessageType_MessageType_TxRequest);
+
+    TxRequest req;
+    memset(&req, 0, sizeof(req));
+    pb_istream_t stream = pb_istream_from_buffer(reply.data(), reply.size());
+    ASSERT_TRUE(pb_decode(&stream, TxRequest_fields, &req));
+    wallet.collect(req);
+    if (req.request_type == RequestType_TXFINISHED) break;
+
+    ASSERT_TRUE(wallet.answer(req, &ack));
+    send_id = MessageType_MessageType_TxAck;
+    fields = TxAck_fields;
+    msg = &ack;
+  }
+
+  // The outputs were asked for while confirming and while serializing,
+  // never while signing: both inputs were signed from the outputs cache.
+  EXPECT_EQ(wallet.output_requests, 4u);
+  EXPECT_EQ(wallet.signatures, 2u);
+
+  // Check each input's signature against the legacy sighash.
+  const Bytes &tx = wallet.serialized;
+  Reader r = {tx, 0};
+  const uint8_t *p;
+  size_t count = 0, len = 0;
+  ASSERT_TRUE(r.take(4, &p));
+  ASSERT_TRUE(r.varint(&count));
+  ASSERT_EQ(count, 2u);
+
+  struct Input {
+    const uint8_t *outpoint;
+    const uint8_t *script;
+    size_t script_len;
+    const uint8_t *sequence;
+  } in[2];
+  for (auto &input : in) {
+    ASSERT_TRUE(r.take(36, &input.outpoint));
+    ASSERT_TRUE(r.varint(&input.script_len));
+    ASSERT_TRUE(r.take(input.script_len, &input.script));
+    ASSERT_TRUE(r.take(4, &input.sequence));
+  }
+  size_t outputs_start = r.pos;
+  ASSERT_TRUE(r.varint(&count));
+  ASSERT_EQ(count, 2u);
+  for (size_t i = 0; i < count; i++) {
+    ASSERT_TRUE(r.take(8, &p));
+    ASSERT_TRUE(r.varint(&len));
+    ASSERT_TRUE(r.take(len, &p));
+  }
+  ASSERT_TRUE(r.take(4, &p));
+  ASSERT_EQ(r.pos, tx.size());
+  Bytes outputs(tx.begin() + outputs_start, tx.end() - 4);
+  ASSERT_EQ(outputs[0], 2);
+
+  for (int i = 0; i < 2; i++) {
+    // scriptSig: <DER signature || SIGHASH_ALL> <compressed public key>
+    const uint8_t *script = in[i].script;
+    size_t sig_len = script[0];
+    ASSERT_EQ(in[i].script_len, 1 + sig_len + 1 + 33);
+    ASSERT_EQ(script[sig_len], 0x01);
+    ASSERT_EQ(script[1 + sig_len], 33);
+    const uint8_t *pubkey = script + 2 + sig_len;
+    EXPECT_EQ(memcmp(pubkey, wallet.inputs[i].public_key, 33), 0);
+
+    Bytes preimage(tx.begin(), tx.begin() + 4);
+    preimage.push_back(2);
+    for (int j = 0; j < 2; j++) {
+      preimage.insert(preimage.end(), in[j].outpoint, in[j].outpoint + 36);
+      Bytes prev_script = p2pkh(wallet.pubkeyhash[j]);
+      if (j != i) prev_script.clear();
+      preimage.push_back((uint8_t)prev_script.size());
+      preimage.insert(preimage.end(), prev_script.begin(), prev_script.end());
+      preimage.insert(preimage.end(), in[j].sequence, in[j].sequence + 4);
+    }
+    preimage.insert(preimage.end(), outputs.begin(), outputs.end());
+    preimage.insert(preimage.end(), tx.end() - 4, tx.end());
+    put_u32(&preimage, 1);  // SIGHASH_ALL
+
+    uint8_t digest[32], sig[64];
+    sha256d(preimage, digest);
+    ASSERT_TRUE(der_to_sig(script + 1, sig_len - 1, sig));
+    EXPECT_EQ(ecdsa_verify_digest(&secp256k1, pubkey, sig, digest), 0)
+        << "input " << i;
+  }
+}
+
+// Signs a contract call with 9000 bytes of data, sending it in chunks of
+// chunk_size, and returns the signature as v || r || s.
+static void sign_ethereum(uint32_t chunk_size, bool stream, Bytes *signature,
+                          int *data_requests) {
+  Device device;
+  ASSERT_NE(device.ctx, nullptr);
+
+  uint16_t msg_id = 0;
+  Bytes reply;
+
+  LoadDevice load;
+  memset(&load, 0, sizeof(load));
+  load.has_mnemonic = true;
+  strncpy(load.mnemonic, MNEMONIC, sizeof(load.mnemonic) - 1);
+  load.has_skip_checksum = true;
+  load.skip_checksum = true;
+  ASSERT_TRUE(device.call(MessageType_MessageType_LoadDevice, LoadDevice_fields,
+                          &load, &msg_id, &reply));
+  ASSERT_EQ(msg_id, MessageType_MessageType_Success);
+
+  ASSERT_EQ(kkemu_ctx_set_ethereum_chunking(device.ctx, chunk_size, stream),
+            chunk_size);
+
+  Bytes data(9000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 31 + 7);
+
+  EthereumSignTx sign;
+  memset(&sign, 0, sizeof(sign));
+  const uint32_t path[] = {HARDENED | 44, HARDENED | 60, HARDENED | 0, 0, 0};
+  memcpy(sign.address_n, path, sizeof(path));
+  sign.address_n_count = 5;
+  sign.has_nonce = true;
+  sign.nonce.size = 1;
+  sign.nonce.bytes[0] = 0x07;
+  sign.has_gas_price = true;
+  sign.gas_price.size = 5;
+  memcpy(sign.gas_price.bytes, "\x04\xa8\x17\xc8\x00", 5);
+  sign.has_gas_limit = true;
+  sign.gas_limit.size = 3;
+  memcpy(sign.gas_limit.bytes, "\x0f\x42\x40", 3);
+  sign.has_to = true;
+  sign.to.size = 20;
+  memset(sign.to.bytes, 0x5a, 20);
+  sign.has_data_initial_chunk = true;
+  sign.data_initial_chunk.size = 1024;
+  memcpy(sign.data_initial_chunk.bytes, data.data(), 1024);
+  sign.has_data_length = true;
+  sign.data_length = data.size();
+  sign.has_chain_id = true;
+  sign.chain_id = 1;
+
+  size_t sent = 1024;
+  EthereumTxRequest req;
+  ASSERT_TRUE(device.call(MessageType_MessageType_EthereumSignTx,
+                          EthereumSignTx_fields, &sign, &msg_id, &reply));
+  for (*data_requests = 0;; ++*data_requests) {
+    ASSERT_EQ(msg_id, MessageType_MessageType_EthereumTxRequest);
+    memset(&req, 0, sizeof(req));
+    pb_istream_t istream = pb_istream_from_buffer(reply.data(), reply.size());
+    ASSERT_TRUE(pb_decode(&istream, EthereumTxRequest_fields, &req));
+    if (!req.has_data_length) break;
+    ASSERT_LE(req.data_length, chunk_size);
+    ASSERT_LT(*data_requests, 20);
+
+    // EthereumTxAck { data_chunk }, streamed until the data runs out. Every
+    // chunk here takes a two byte length.
+    do {
+      size_t len = std::min<size_t>(req.data_length, data.size() - sent);
+      Bytes ack = {0x0a, (uint8_t)(len | 0x80), (uint8_t)(len >> 7)};
+      ack.insert(ack.end(), data.begin() + sent, data.begin() + sent + len);
+      sent += len;
+      auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(30);
+      while (kkemu_ctx_send_message(device.ctx, KKEMU_IFACE_MAIN,
+                                    MessageType_MessageType_EthereumTxAck,
+                                    ack.data(), ack.size()) != 0) {
+        ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    } while (stream && sent < data.size());
+    ASSERT_TRUE(device.recv(&msg_id, &reply));
+  }
+  EXPECT_EQ(sent, data.size());
+
+  ASSERT_TRUE(req.has_signature_v);
+  ASSERT_EQ(req.signature_r.size, 32u);
+  ASSERT_EQ(req.signature_s.size, 32u);
+  signature->assign(1, (uint8_t)req.signature_v);
+  signature->insert(signature->end(), req.signature_r.bytes,
+                    req.signature_r.bytes + 32);
+  signature->insert(signature->end(), req.signature_s.bytes,
+                    req.signature_s.bytes + 32);
+}
+
+TEST(SignTx, EthereumDataChunking) {
+  Bytes lockstep, larger, streamed;
+  int requests = 0;
+
+  ASSERT_NO_FATAL_FAILURE(sign_ethereum(1024, false, &lockstep, &requests));
+  EXPECT_EQ(requests, 8);
+
+  ASSERT_NO_FATAL_FAILURE(sign_ethereum(4096, false, &larger, &requests));
+  EXPECT_EQ(requests, 2);
+  EXPECT_EQ(larger, lockstep);
+
+  ASSERT_NO_FATAL_FAILURE(sign_ethereum(2048, true, &streamed, &requests));
+  EXPECT_EQ(requests, 1);
+  EXPECT_EQ(streamed, lockstep);
+}
+
+TEST(SignTx, EthereumChunkSizeIsClamped) {
+  Device device;
+  ASSERT_NE(device.ctx, nullptr);
+  EXPECT_EQ(kkemu_ctx_set_ethereum_chunking(device.ctx, 1, false), 1024u);
+  EXPECT_EQ(kkemu_ctx_set_ethereum_chunking(device.ctx, 1u << 20, true),
+            7680u);
+  EXPECT_EQ(kkemu_ctx_set_ethereum_chunking(nullptr, 4096, false), 0u);
+}
+
+#endif
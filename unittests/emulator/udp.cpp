@@ -0,0 +1,196 @@
+extern "C" {
+#include "keepkey/emulator/emulator.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+typedef std::vector<uint8_t> Report;
+
+// Host ends of the emulator's main and debug interfaces.
+static int host_fd[2] = {-1, -1};
+
+static Report report(uint32_t seq) {
+  Report r(64);
+  for (size_t i = 0; i < r.size(); i++) r[i] = (uint8_t)(seq * 13 + i);
+  r[0] = '?';
+  return r;
+}
+
+static void host_send(int iface, const Report &r) {
+  ASSERT_EQ(send(host_fd[iface], r.data(), r.size(), 0), (ssize_t)r.size());
+}
+
+static std::vector<Report> host_recv(int iface) {
+  std::vector<Report> reports;
+  Report r(64);
+  ssize_t n;
+  while ((n = recv(host_fd[iface], r.data(), r.size(), MSG_DONTWAIT)) > 0) {
+    reports.push_back(Report(r.begin(), r.begin() + n));
+  }
+  return reports;
+}
+
+// Everything the emulator has received, waiting up to `timeout_ms` for more.
+static std::vector<std::pair<int, Report>> emu_recv(int timeout_ms = 100) {
+  std::vector<std::pair<int, Report>> reports;
+  while (emulatorSocketWait(timeout_ms)) {
+    int iface = -1;
+    Report r(64);
+    size_t n;
+    while ((n = emulatorSocketRead(&iface, r.data(), r.size())) > 0) {
+      reports.push_back({iface, Report(r.begin(), r.begin() + n)});
+    }
+  }
+  return reports;
+}
+
+class UDP : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    // Let the kernel pick free ports for the emulator to bind.
+    setenv("KEEPKEY_UDP_PORT", "0", 1);
+    emulatorSocketInit();
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int iface = 0; iface < 2; iface++) {
+      host_fd[iface] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+      addr.sin_port = htons(emulatorSocketPort(iface));
+      connect(host_fd[iface], (struct sockaddr *)&addr, sizeof(addr));
+    }
+  }
+
+  // Start every test with nothing in flight either way.
+  void SetUp() override {
+    emu_recv(0);
+    emulatorSocketFlush();
+    host_recv(0);
+    host_recv(1);
+  }
+};
+
+TEST_F(UDP, PingPong) {
+  const char ping[] = "PINGPING";
+  host_send(0, Report(ping, ping + 8));
+
+  // Answered inside the read, never handed to the firmware.
+  EXPECT_TRUE(emu_recv().empty());
+
+  std::vector<Report> replies = host_recv(0);
+  ASSERT_EQ(replies.size(), 1u);
+  EXPECT_EQ(std::string(replies[0].begin(), replies[0].end()), "PONGPONG");
+}
+
+TEST_F(UDP, ReceivesMoreThanABatchInOrder) {
+  // More than one recvmmsg() batch of 64, with pings mixed in.
+  const char ping[] = "PINGPING";
+  for (uint32_t i = 0; i < 150; i++) {
+    host_send(0, report(i));
+    if (i % 50 == 7) host_send(0, Report(ping, ping + 8));
+  }
+
+  std::vector<std::pair<int, Report>> got = emu_recv();
+  ASSERT_EQ(got.size(), 150u);
+  for (uint32_t i = 0; i < got.size(); i++) {
+    EXPECT_EQ(got[i].first, 0);
+    EXPECT_EQ(got[i].second, report(i)) << i;
+  }
+  EXPECT_EQ(host_recv(0).size(), 3u);
+}
+
+TEST_F(UDP, ReadsBothInterfaces) {
+  host_send(0, report(1));
+  host_send(1, report(2));
+  host_send(0, report(3));
+
+  // Main drains before debug.
+  std::vector<std::pair<int, Report>> got = emu_recv();
+  ASSERT_EQ(got.size(), 3u);
+  EXPECT_EQ(got[0], std::make_pair(0, report(1)));
+  EXPECT_EQ(got[1], std::make_pair(0, report(3)));
+  EXPECT_EQ(got[2], std::make_pair(1, report(2)));
+}
+
+TEST_F(UDP, SendsMoreThanABatchInOrder) {
+  // The emulator replies to whoever wrote last on each interface.
+  host_send(0, report(0));
+  host_send(1, report(0));
+  ASSERT_EQ(emu_recv().size(), 2u);
+
+  for (uint32_t i = 0; i < 150; i++) {
+    Report r = report(i);
+    EXPECT_EQ(emulatorSocketWrite(i % 3 == 0, r.data(), r.size()), r.size());
+  }
+
+  // Full batches have already gone out; the rest waits for a flush.
+  std::vector<Report> main = host_recv(0);
+  EXPECT_EQ(main.size(), 64u);
+  emulatorSocketFlush();
+  std::vector<Report> more = host_recv(0);
+  main.insert(main.end(), more.begin(), more.end());
+  std::vector<Report> debug = host_recv(1);
+
+  ASSERT_EQ(main.size(), 100u);
+  ASSERT_EQ(debug.size(), 50u);
+  for (uint32_t i = 0, m = 0, d = 0; i < 150; i++) {
+    if (i % 3 == 0) {
+      EXPECT_EQ(debug[d++], report(i)) << i;
+    } else {
+      EXPECT_EQ(main[m++], report(i)) << i;
+    }
+  }
+}
+
+TEST_F(UDP, WaitFlushesOutput) {
+  host_send(0, report(0));
+  ASSERT_EQ(emu_recv().size(), 1u);
+
+  Report r = report(1);
+  emulatorSocketWrite(0, r.data(), r.size());
+  EXPECT_TRUE(host_recv(0).empty());
+
+  // Nothing arrives, but the reply still goes out before the sleep.
+  EXPECT_EQ(emulatorSocketWait(0), 0);
+  std::vector<Report> got = host_recv(0);
+  ASSERT_EQ(got.size(), 1u);
+  EXPECT_EQ(got[0], r);
+}
+
+TEST_F(UDP, WaitTimesOut) {
+  // A signal may end the wait early, and a busy machine may end it late, so
+  // only check that it does end.
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(emulatorSocketWait(50), 0);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(10));
+}
+
+TEST_F(UDP, WaitWakesOnInput) {
+  host_send(1, report(0));
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(emulatorSocketWait(5000), 1);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(1000));
+
+  // Reports already pulled off the socket count as input too.
+  host_send(0, report(1));
+  host_send(0, report(2));
+  ASSERT_TRUE(emulatorSocketWait(1000));
+  int iface = -1;
+  Report r(64);
+  ASSERT_EQ(emulatorSocketRead(&iface, r.data(), r.size()), r.size());
+  EXPECT_EQ(r, report(1));
+  EXPECT_EQ(emulatorSocketWait(0), 1);
+}
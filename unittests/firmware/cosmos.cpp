@@ -4,9 +4,11 @@ extern "C" {
 #include "keepkey/firmware/signtx_tendermint.h"
 #include "keepkey/firmware/tendermint.h"
 #include "trezor/crypto/secp256k1.h"
+#include "trezor/crypto/sha2.h"
 }
 
 #include "gtest/gtest.h"
+#include <cinttypes>
 #include <cstring>
 
 TEST(Cosmos, CosmosGetAddress) {
@@ -72,3 +74,54 @@ TEST(Cosmos, CosmosSignTx) {
                         "\x47\x56\x43\xca\x33\xc7\xad\x2c\x8a\x53\x2b\x39",
              64) == 0);
 }
+
+TEST(Cosmos, TendermintEscaped) {
+  const char* inputs[] = {
+      "", "plain memo", "\"", "\\", "a \"quoted\" \\path\\ in a long memo",
+      "exactly8\"exactly8\\exactly8"};
+  for (const char* in : inputs) {
+    std::string escaped;
+    for (const char* c = in; *c; c++) {
+      if (*c == '"' || *c == '\\') escaped += '\\';
+      escaped += *c;
+    }
+
+    uint8_t expected[32], actual[32];
+    sha256_Raw((const uint8_t*)escaped.data(), escaped.size(), expected);
+
+    SHA256_CTX ctx;
+    sha256_Init(&ctx);
+    tendermint_sha256UpdateEscaped(&ctx, in, strlen(in));
+    sha256_Final(&ctx, actual);
+    EXPECT_TRUE(memcmp(expected, actual, 32) == 0) << in;
+  }
+}
+
+TEST(Cosmos, TendermintSnprintf) {
+  char temp[64], expected[64];
+  SHA256_CTX ctx;
+  uint8_t hash[32], expected_hash[32];
+
+  int n = snprintf(expected, sizeof(expected),
+                   "{\"amount\":\"%" PRIu64 "\",\"n\":%" PRIu32
+                   ",\"denom\":\"%s\"}",
+                   UINT64_MAX, UINT32_MAX, "uatom");
+  sha256_Raw((const uint8_t*)expected, n, expected_hash);
+
+  sha256_Init(&ctx);
+  ASSERT_TRUE(tendermint_snprintf(&ctx, temp, sizeof(temp),
+                                  "{\"amount\":\"%" PRIu64 "\",\"n\":%" PRIu32
+                                  ",\"denom\":\"%s\"}",
+                                  UINT64_MAX, UINT32_MAX, "uatom"));
+  sha256_Final(&ctx, hash);
+  EXPECT_EQ(std::string(expected), temp);
+  EXPECT_TRUE(memcmp(expected_hash, hash, 32) == 0);
+
+  sha256_Init(&ctx);
+  EXPECT_FALSE(tendermint_snprintf(&ctx, temp, 8, "%s", "12345678"));
+  EXPECT_TRUE(tendermint_snprintf(&ctx, temp, 8, "%s", "1234567"));
+
+  EXPECT_TRUE(tendermint_snprintf(&ctx, temp, sizeof(temp), "[%s]",
+                                  (const char*)NULL));
+  EXPECT_EQ(std::string("[(null)]"), temp);
+}
@@ -0,0 +1,103 @@
+extern "C" {
+#include "keepkey/firmware/prevtx_cache.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+struct TxId {
+  uint8_t bytes[32];
+  explicit TxId(uint8_t fill) { memset(bytes, fill, sizeof(bytes)); }
+};
+
+// Stream outputs [0, count) of a prevtx, each worth 1000 * txid + index.
+static void stream(const TxId &txid, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    prevtx_cache_add(i, 1000 * txid.bytes[0] + i);
+  }
+  prevtx_cache_commit(txid.bytes);
+}
+
+static bool cached(const TxId &txid, uint32_t index) {
+  uint64_t amount = 0;
+  if (!prevtx_cache_lookup(txid.bytes, index, &amount)) return false;
+  EXPECT_EQ(amount, 1000u * txid.bytes[0] + index);
+  return true;
+}
+
+TEST(PrevTxCache, VisibleOnlyOnceVerified) {
+  prevtx_cache_init();
+  TxId a(1);
+
+  prevtx_cache_add(0, 1000);
+  EXPECT_FALSE(cached(a, 0));
+
+  prevtx_cache_commit(a.bytes);
+  EXPECT_TRUE(cached(a, 0));
+
+  prevtx_cache_init();
+  EXPECT_FALSE(cached(a, 0));
+}
+
+TEST(PrevTxCache, TwoInputsSpendSamePrevTx) {
+  prevtx_cache_init();
+  TxId a(1), b(2);
+
+  // The first input streams the prevtx; the second spends another output
+  // of it and finds the amount without streaming it again.
+  stream(a, 3);
+  EXPECT_TRUE(cached(a, 0));
+  EXPECT_TRUE(cached(a, 2));
+
+  EXPECT_FALSE(cached(a, 3));
+  EXPECT_FALSE(cached(b, 0));
+}
+
+TEST(PrevTxCache, SameTxIdKeepsItsSlot) {
+  prevtx_cache_init();
+  TxId a(1), b(2), c(3), d(4), e(5);
+
+  // Streaming a prevtx again, e.g. for an input the cache missed, must not
+  // use up another txid slot or duplicate its outputs.
+  stream(a, 2);
+  stream(a, 2);
+  stream(a, 2);
+  stream(b, 2);
+  stream(c, 2);
+  stream(d, 2);
+  EXPECT_TRUE(cached(a, 1));
+  EXPECT_TRUE(cached(d, 1));
+
+  // Only then is the cache full of txids.
+  stream(e, 2);
+  EXPECT_FALSE(cached(e, 0));
+  EXPECT_TRUE(cached(a, 0));
+}
+
+TEST(PrevTxCache, FullCacheDropsUnverifiedOutputs) {
+  prevtx_cache_init();
+  TxId ids[PREVTX_CACHE_TXIDS + 2] = {TxId(1), TxId(2), TxId(3),
+                                      TxId(4), TxId(5), TxId(6)};
+
+  for (int i = 0; i < PREVTX_CACHE_TXIDS; i++) stream(ids[i], 1);
+
+  // A prevtx with no slot left leaves nothing behind for the next one.
+  stream(ids[PREVTX_CACHE_TXIDS], 4);
+  EXPECT_FALSE(cached(ids[PREVTX_CACHE_TXIDS], 0));
+  stream(ids[0], 4);
+  EXPECT_TRUE(cached(ids[0], 3));
+}
+
+TEST(PrevTxCache, OutputLimit) {
+  prevtx_cache_init();
+  TxId a(1), b(2);
+
+  stream(a, PREVTX_CACHE_OUTPUTS + 10);
+  EXPECT_TRUE(cached(a, PREVTX_CACHE_OUTPUTS - 1));
+  EXPECT_FALSE(cached(a, PREVTX_CACHE_OUTPUTS));
+
+  // Later prevtxs still stream fine, they just aren't cached.
+  stream(b, 1);
+  EXPECT_FALSE(cached(b, 0));
+}
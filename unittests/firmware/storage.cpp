@@ -2,8 +2,11 @@ extern "C" {
 #include "keepkey/firmware/storage.h"
 #include "keepkey/firmware/policy.h"
 #include "keepkey/board/keepkey_board.h"
+#include "keepkey/board/keepkey_flash.h"
 #include "trezor/crypto/memzero.h"
 #include "trezor/crypto/aes/aes.h"
+#include "trezor/crypto/bip32.h"
+#include "trezor/crypto/curves.h"
 #include "types.pb.h"
 #include "storage.h"
 }
@@ -13,6 +16,7 @@ extern "C" {
 
 #include <cstring>
 #include <string>
+#include <vector>
 
 using ::testing::ElementsAreArray;
 
@@ -653,7 +657,7 @@ TEST(Storage, StorageRoundTrip) {
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x00, 0x00, 0x00, 0xe4, 0x8d, 0xfe, 0xcf, 0xd0, 0x54, 0x71,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x12, 0x00, 0x00, 0x00, 0xe4, 0x8d, 0xfe, 0xcf, 0xd0, 0x54, 0x71,
         0x50, 0xcb, 0x12, 0x84, 0xfa, 0x5f, 0xbf, 0xcb, 0x09, 0xca, 0x00, 0xf1, 0x37, 0xe4, 0x8f, 0x5e,
         0xf9, 0x81, 0x57, 0x26, 0xb6, 0x7b, 0x8e, 0x03, 0x44, 0x9a, 0x2a, 0x7c, 0xf4, 0x3c, 0x79, 0x87,
         0x5d, 0x26, 0xae, 0x9b, 0x4b, 0xb4, 0xd2, 0xc4, 0x67, 0x97, 0xe7, 0x6b, 0x6c, 0x4c, 0xbe, 0x68,
@@ -939,3 +943,273 @@ TEST(Storage, Reset) {
 
   ASSERT_TRUE(memcmp(session.storageKey, new_storage_key, 64) == 0);
 }
+
+TEST(Storage, DeriveNodeCache) {
+  SessionState session;
+  memset(&session, 0, sizeof(session));
+
+  uint8_t seed[32];
+  for (size_t i = 0; i < sizeof(seed); i++) seed[i] = i;
+
+  HDNode root;
+  ASSERT_EQ(hdnode_from_seed(seed, sizeof(seed), SECP256K1_NAME, &root), 1);
+
+  for (uint32_t i = 0; i < 3 * SESSION_NODE_CACHE_SIZE; i++) {
+    // Alternate accounts so entries are reused as well as evicted.
+    uint32_t address_n[] = {0x80000000 | 44, 0x80000000,
+                            0x80000000 | (i % (SESSION_NODE_CACHE_SIZE + 2)),
+                            0, i};
+
+    HDNode expected = root;
+    uint32_t expected_fp = 0;
+    ASSERT_EQ(hdnode_private_ckd_cached(&expected, address_n, 5, &expected_fp),
+              1);
+    hdnode_fill_public_key(&expected);
+
+    HDNode actual = root;
+    uint32_t actual_fp = 0;
+    ASSERT_EQ(session_deriveNode_impl(&session, &actual, address_n, 5,
+                                      &actual_fp),
+              1);
+    hdnode_fill_public_key(&actual);
+
+    EXPECT_EQ(actual_fp, expected_fp) << "i: " << i;
+    EXPECT_EQ(actual.depth, expected.depth);
+    EXPECT_EQ(actual.child_num, expected.child_num);
+    EXPECT_TRUE(memcmp(actual.private_key, expected.private_key, 32) == 0);
+    EXPECT_TRUE(memcmp(actual.chain_code, expected.chain_code, 32) == 0);
+    EXPECT_TRUE(memcmp(actual.public_key, expected.public_key, 33) == 0);
+  }
+
+  session_clearNodeCache(&session);
+  for (size_t i = 0; i < SESSION_NODE_CACHE_SIZE; i++) {
+    ASSERT_FALSE(session.nodeCache[i].valid);
+  }
+}
+
+TEST(Storage, RootNodeCache) {
+  SessionState session;
+  memset(&session, 0, sizeof(session));
+
+  uint8_t seed[64];
+  for (size_t i = 0; i < sizeof(seed); i++) seed[i] = i;
+
+  const char* curves[] = {SECP256K1_NAME, NIST256P1_NAME, ED25519_NAME};
+  HDNode roots[3];
+  for (size_t i = 0; i < 3; i++) {
+    const curve_info* info = get_curve_by_name(curves[i]);
+    ASSERT_TRUE(session_getCachedRoot(&session, info, true) == NULL);
+    ASSERT_EQ(hdnode_from_seed(seed, sizeof(seed), curves[i], &roots[i]), 1);
+    session_cacheRoot(&session, info, true, &roots[i]);
+    hdnode_fill_public_key(&roots[i]);
+  }
+
+  for (size_t i = 0; i < 3; i++) {
+    const curve_info* info = get_curve_by_name(curves[i]);
+    ASSERT_TRUE(session_getCachedRoot(&session, info, false) == NULL);
+    const HDNode* cached = session_getCachedRoot(&session, info, true);
+    ASSERT_TRUE(cached != NULL);
+    EXPECT_TRUE(memcmp(cached, &roots[i], sizeof(HDNode)) == 0) << curves[i];
+  }
+
+  session_clearNodeCache(&session);
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(session_getCachedRoot(
+                    &session, get_curve_by_name(curves[i]), true) == NULL);
+  }
+}
+
+TEST(Storage, LogReplay) {
+  std::vector<char> sector(STORAGE_SECTOR_LEN, (char)0xff);
+  for (size_t i = 0; i < STORAGE_IMAGE_LEN; i++) {
+    sector[i] = (char)(i * 7);
+  }
+  memcpy(&sector[44], "\x12\x00\x00\x00", 4);  // v18
+
+  std::vector<char> image(STORAGE_IMAGE_LEN), next(STORAGE_IMAGE_LEN);
+  uint32_t chain;
+  ASSERT_EQ(storage_replayLog(&sector[0], &image[0], &chain),
+            (uint32_t)STORAGE_LOG_START);
+  EXPECT_TRUE(memcmp(&image[0], &sector[0], STORAGE_IMAGE_LEN) == 0);
+
+  // Bump pin_failed_attempts and u2f_counter, and change the label.
+  next = image;
+  next[44 + 8]++;
+  next[44 + 401]++;
+  memcpy(&next[44 + 32], "journaled", 9);
+
+  StorageLogSpan spans[STORAGE_LOG_SPANS];
+  ASSERT_EQ(storage_diffLog(&image[0], &next[0], spans), 2);
+  EXPECT_EQ(spans[0].offset, 44 + 8);
+  EXPECT_EQ(spans[0].len, 32 + 9 - 8);
+  EXPECT_EQ(spans[1].offset, 44 + 401);
+  EXPECT_EQ(spans[1].len, 1);
+
+  uint32_t end = STORAGE_LOG_START;
+  uint8_t record[STORAGE_LOG_RECORD_MAX + 8];
+  for (int i = 0; i < 2; i++) {
+    size_t len = storage_encodeLogRecord(record, &chain, &spans[i],
+                                         &next[spans[i].offset]);
+    memcpy(&sector[end], record, len);
+    end += len;
+  }
+
+  std::vector<char> replayed(STORAGE_IMAGE_LEN);
+  uint32_t replayed_chain;
+  EXPECT_EQ(storage_replayLog(&sector[0], &replayed[0], &replayed_chain), end);
+  EXPECT_EQ(replayed_chain, chain);
+  EXPECT_TRUE(memcmp(&replayed[0], &next[0], STORAGE_IMAGE_LEN) == 0);
+
+  // Changes to the secrets or the version always rewrite the sector.
+  next[44 + 1501]++;
+  EXPECT_EQ(storage_diffLog(&replayed[0], &next[0], spans), -1);
+  EXPECT_EQ(storage_diffLog(&replayed[0], &replayed[0], spans), 0);
+  next = replayed;
+  next[44]++;
+  EXPECT_EQ(storage_diffLog(&replayed[0], &next[0], spans), -1);
+
+  // Records outside the journaled windows are never applied, even when they
+  // verify; the log is reported full instead.
+  const std::vector<char> logged = replayed;
+  const StorageLogSpan outside[] = {
+      {44, 4},            // the version
+      {44 + 4 + 70, 10},  // straddling the end of a window
+      {44 + 1501, 4},     // the encrypted secrets
+  };
+  for (const StorageLogSpan &bad : outside) {
+    uint32_t bad_chain = chain;
+    const char data[10] = {0x11};
+    size_t len = storage_encodeLogRecord(record, &bad_chain, &bad, data);
+    memcpy(&sector[end], record, len);
+    EXPECT_EQ(storage_replayLog(&sector[0], &replayed[0], &replayed_chain),
+              (uint32_t)STORAGE_LOG_END)
+        << bad.offset;
+    EXPECT_TRUE(memcmp(&replayed[0], &logged[0], STORAGE_IMAGE_LEN) == 0)
+        << bad.offset;
+    memset(&sector[end], 0xff, len);
+  }
+
+  // A torn record is ignored, and the log is reported full.
+  sector[end - 1] ^= 0x01;
+  EXPECT_EQ(storage_replayLog(&sector[0], &replayed[0], &replayed_chain),
+            (uint32_t)STORAGE_LOG_END);
+  EXPECT_EQ(replayed[44 + 401], image[44 + 401]);
+  EXPECT_EQ(replayed[44 + 8], (char)(image[44 + 8] + 1));
+
+  // A v17 sector has no log, even if what follows its image would verify.
+  sector.assign(STORAGE_SECTOR_LEN, (char)0xff);
+  memcpy(&sector[0], &image[0], STORAGE_IMAGE_LEN);
+  sector[44] = 17;
+  chain = calc_crc32(&sector[0], STORAGE_IMAGE_LEN / sizeof(uint32_t));
+  StorageLogSpan span = {44 + 8, 1};
+  char bumped = (char)(image[44 + 8] + 1);
+  size_t len = storage_encodeLogRecord(record, &chain, &span, &bumped);
+  memcpy(&sector[STORAGE_LOG_START], record, len);
+  EXPECT_EQ(storage_replayLog(&sector[0], &replayed[0], &replayed_chain),
+            (uint32_t)STORAGE_LOG_END);
+  EXPECT_EQ(replayed[44 + 8], image[44 + 8]);
+}
+
+TEST(Storage, U2FAreaCount) {
+  std::vector<char> sector(STORAGE_SECTOR_LEN, (char)0xff);
+  memcpy(&sector[44], "\x12\x00\x00\x00", 4);  // v18
+  EXPECT_EQ(storage_u2fAreaCount(&sector[0]), 0u);
+
+  // Two words used up, and three bits of the next one.
+  memset(&sector[STORAGE_U2F_AREA_START], 0, 8);
+  sector[STORAGE_U2F_AREA_START + 8] = (char)0xf8;
+  EXPECT_EQ(storage_u2fAreaCount(&sector[0]), 67u);
+
+  memset(&sector[STORAGE_U2F_AREA_START], 0, STORAGE_U2F_AREA_LEN);
+  EXPECT_EQ(storage_u2fAreaCount(&sector[0]), STORAGE_U2F_AREA_LEN * 8u);
+
+  // Older sectors never had the area.
+  sector[44] = 17;
+  EXPECT_EQ(storage_u2fAreaCount(&sector[0]), 0u);
+}
+
+TEST(Storage, FlushSurvivesInit) {
+  std::vector<uint8_t> flash(FLASH_TOTAL_SIZE, 0xff);
+  uint8_t* saved_base = emulator_flash_base;
+  emulator_flash_base = flash.data();
+
+  storage_wipe();
+  storage_init();
+  ASSERT_EQ(storage_getLabel(), nullptr);
+
+  // A deferred change only reaches flash once it is flushed.
+  storage_setLabel("deferred");
+  storage_setAutoLockDelayMs(10 * 60 * 1000);
+  storage_commitDeferred();
+  storage_init();
+  EXPECT_EQ(storage_getLabel(), nullptr);
+  EXPECT_EQ(storage_getAutoLockDelayMs(),
+            (uint32_t)STORAGE_DEFAULT_SCREENSAVER_TIMEOUT);
+
+  storage_setLabel("deferred");
+  storage_setAutoLockDelayMs(10 * 60 * 1000);
+  storage_commitDeferred();
+  storage_flush();
+  storage_init();
+  ASSERT_NE(storage_getLabel(), nullptr);
+  EXPECT_EQ(std::string(storage_getLabel()), "deferred");
+  EXPECT_EQ(storage_getAutoLockDelayMs(), 10u * 60 * 1000);
+
+  storage_wipe();
+  emulator_flash_base = saved_base;
+}
+
+TEST(Storage, LogSurvivesReboot) {
+  std::vector<uint8_t> flash(FLASH_TOTAL_SIZE, 0xff);
+  uint8_t* saved_base = emulator_flash_base;
+  emulator_flash_base = flash.data();
+
+  const char mnemonic[] =
+      "abandon abandon abandon abandon abandon abandon abandon abandon "
+      "abandon abandon abandon about";
+  storage_wipe();
+  storage_init();
+  storage_setMnemonic(mnemonic);
+  storage_commit();
+
+  const Allocation sectors[] = {FLASH_STORAGE1, FLASH_STORAGE2,
+                                FLASH_STORAGE3};
+  std::vector<std::vector<uint8_t>> images;
+  for (Allocation sector : sectors) {
+    const uint8_t* base = (const uint8_t*)flash_write_helper(sector);
+    images.push_back(std::vector<uint8_t>(base, base + STORAGE_IMAGE_LEN));
+  }
+
+  // These only touch the journaled window, so they go into the log and
+  // leave every image, encrypted secrets included, as it was.
+  storage_setLabel("journaled");
+  storage_commit();
+  storage_increasePinFails();
+  storage_increasePinFails();
+  for (size_t i = 0; i < images.size(); i++) {
+    const uint8_t* base = (const uint8_t*)flash_write_helper(sectors[i]);
+    EXPECT_TRUE(memcmp(base, images[i].data(), STORAGE_IMAGE_LEN) == 0) << i;
+  }
+
+  // Reboot: the log is replayed on top of the image, and the secrets still
+  // decrypt.
+  storage_init();
+  ASSERT_NE(storage_getLabel(), nullptr);
+  EXPECT_EQ(std::string(storage_getLabel()), "journaled");
+  EXPECT_EQ(storage_getPinFails(), 2u);
+  EXPECT_TRUE(storage_containsMnemonic(mnemonic));
+
+  // Changed secrets are never left behind in the old ciphertext.
+  const char other[] =
+      "legal winner thank year wave sausage worth useful legal winner thank "
+      "yellow";
+  storage_setMnemonic(other);
+  storage_commit();
+  storage_init();
+  EXPECT_TRUE(storage_containsMnemonic(other));
+  EXPECT_EQ(std::string(storage_getLabel()), "journaled");
+  EXPECT_EQ(storage_getPinFails(), 2u);
+
+  storage_wipe();
+  emulator_flash_base = saved_base;
+}
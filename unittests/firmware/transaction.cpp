@@ -0,0 +1,217 @@
+extern "C" {
+#include "keepkey/firmware/transaction.h"
+#include "trezor/crypto/bip32.h"
+#include "trezor/crypto/curves.h"
+#include "trezor/crypto/ecdsa.h"
+#include "trezor/crypto/hasher.h"
+#include "trezor/crypto/secp256k1.h"
+}
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <vector>
+
+struct Tx {
+  std::vector<TxInputType> inputs;
+  std::vector<TxOutputBinType> outputs;
+};
+
+static TxInputType p2pkh_input(uint8_t n) {
+  TxInputType in;
+  memset(&in, 0, sizeof(in));
+  in.prev_hash.size = 32;
+  memset(in.prev_hash.bytes, 0x10 + n, 32);
+  in.prev_index = n;
+  in.has_sequence = true;
+  in.sequence = 0xffffffff;
+
+  // The previous output's script stands in for scriptSig while signing.
+  uint8_t pubkeyhash[20];
+  memset(pubkeyhash, 0x20 + n, sizeof(pubkeyhash));
+  in.has_script_sig = true;
+  in.script_sig.size = compile_script_sig(0, pubkeyhash, in.script_sig.bytes);
+  return in;
+}
+
+static TxOutputBinType output(uint64_t amount, size_t script_len,
+                              uint8_t fill) {
+  TxOutputBinType out;
+  memset(&out, 0, sizeof(out));
+  out.amount = amount;
+  out.script_pubkey.size = script_len;
+  memset(out.script_pubkey.bytes, fill, script_len);
+  return out;
+}
+
+static Tx sample_tx() {
+  Tx tx;
+  for (uint8_t i = 0; i < 3; i++) tx.inputs.push_back(p2pkh_input(i));
+
+  uint8_t pubkeyhash[20] = {1, 2, 3};
+  TxOutputBinType pay = output(123456, 0, 0);
+  pay.script_pubkey.size =
+      compile_script_sig(0, pubkeyhash, pay.script_pubkey.bytes);
+  tx.outputs.push_back(pay);
+  tx.outputs.push_back(output(5000, 23, 0xa9));
+  tx.outputs.push_back(output(0, 80, 0x6a));
+  tx.outputs.push_back(output(99, 300, 0x51));
+  return tx;
+}
+
+// Fill a cache the way signing does in phase 1. False once it overflows.
+static bool cache_outputs(const Tx &tx, std::vector<uint8_t> *cache) {
+  cache->resize(TX_OUTPUTS_CACHE_SIZE);
+  uint32_t len = 0;
+  for (const TxOutputBinType &out : tx.outputs) {
+    uint32_t r = tx_serialize_output_raw(&out, cache->data() + len,
+                                         cache->size() - len);
+    if (!r) return false;
+    len += r;
+  }
+  cache->resize(len);
+  return true;
+}
+
+static void init_tx(const Tx &tx, TxStruct *ti) {
+  tx_init(ti, tx.inputs.size(), tx.outputs.size(), 1, 0, 0, 0, HASHER_SHA2D,
+          false, 0);
+}
+
+static TxInputType blanked(const Tx &tx, size_t i, size_t signing) {
+  TxInputType in = tx.inputs[i];
+  if (i != signing) in.script_sig.size = 0;
+  return in;
+}
+
+// Legacy sighash of input `signing`, hashing the outputs from `cache` when
+// given, or one at a time as they are streamed otherwise.
+static void sighash(const Tx &tx, size_t signing,
+                    const std::vector<uint8_t> *cache, uint8_t hash[32]) {
+  TxStruct ti;
+  init_tx(tx, &ti);
+  for (size_t i = 0; i < tx.inputs.size(); i++) {
+    TxInputType in = blanked(tx, i, signing);
+    ASSERT_NE(tx_serialize_input_hash(&ti, &in), 0u);
+  }
+  if (cache) {
+    ASSERT_NE(tx_serialize_outputs_raw_hash(&ti, cache->data(), cache->size()),
+              0u);
+  } else {
+    for (const TxOutputBinType &out : tx.outputs) {
+      ASSERT_NE(tx_serialize_output_hash(&ti, &out), 0u);
+    }
+  }
+  uint32_t hash_type = 1;  // SIGHASH_ALL
+  hasher_Update(&ti.hasher, (const uint8_t *)&hash_type, 4);
+  tx_hash_final(&ti, hash, false);
+}
+
+// The same sighash from the fully serialized transaction.
+static void reference_sighash(const Tx &tx, size_t signing, uint8_t hash[32]) {
+  TxStruct ti;
+  init_tx(tx, &ti);
+  std::vector<uint8_t> raw;
+  uint8_t buf[4096];
+  for (size_t i = 0; i < tx.inputs.size(); i++) {
+    TxInputType in = blanked(tx, i, signing);
+    uint32_t r = tx_serialize_input(&ti, &in, buf);
+    raw.insert(raw.end(), buf, buf + r);
+  }
+  for (const TxOutputBinType &out : tx.outputs) {
+    uint32_t r = tx_serialize_output(&ti, &out, buf);
+    raw.insert(raw.end(), buf, buf + r);
+  }
+  const uint8_t hash_type[4] = {1, 0, 0, 0};
+  raw.insert(raw.end(), hash_type, hash_type + 4);
+
+  Hasher hasher;
+  hasher_Init(&hasher, HASHER_SHA2D);
+  hasher_Update(&hasher, raw.data(), raw.size());
+  hasher_Final(&hasher, hash);
+}
+
+static HDNode signing_node() {
+  uint8_t seed[64];
+  for (size_t i = 0; i < sizeof(seed); i++) seed[i] = i;
+  HDNode node;
+  hdnode_from_seed(seed, sizeof(seed), SECP256K1_NAME, &node);
+  hdnode_fill_public_key(&node);
+  return node;
+}
+
+TEST(Transaction, CachedOutputsSignLikeStreamed) {
+  Tx tx = sample_tx();
+  std::vector<uint8_t> cache;
+  ASSERT_TRUE(cache_outputs(tx, &cache));
+
+  HDNode node = signing_node();
+  for (size_t i = 0; i < tx.inputs.size(); i++) {
+    uint8_t cached[32], streamed[32], reference[32];
+    sighash(tx, i, &cache, cached);
+    sighash(tx, i, nullptr, streamed);
+    reference_sighash(tx, i, reference);
+    EXPECT_EQ(memcmp(cached, reference, 32), 0) << i;
+    EXPECT_EQ(memcmp(streamed, reference, 32), 0) << i;
+
+    // Signing is deterministic, so both paths produce the same signature.
+    uint8_t sig_cached[64], sig_streamed[64];
+    ASSERT_EQ(hdnode_sign_digest(&node, cached, sig_cached, NULL, NULL), 0);
+    ASSERT_EQ(hdnode_sign_digest(&node, streamed, sig_streamed, NULL, NULL),
+              0);
+    EXPECT_EQ(memcmp(sig_cached, sig_streamed, 64), 0) << i;
+    EXPECT_EQ(
+        ecdsa_verify_digest(&secp256k1, node.public_key, sig_cached, reference),
+        0);
+  }
+}
+
+TEST(Transaction, OutputsCacheFillsExactly) {
+  // Three outputs of 8 + 3 + 500 bytes, then one that takes the last 515.
+  Tx tx = sample_tx();
+  tx.outputs.clear();
+  for (int i = 0; i < 3; i++) tx.outputs.push_back(output(i, 500, i));
+  tx.outputs.push_back(output(3, 504, 3));
+
+  std::vector<uint8_t> cache;
+  ASSERT_TRUE(cache_outputs(tx, &cache));
+  EXPECT_EQ(cache.size(), (size_t)TX_OUTPUTS_CACHE_SIZE);
+
+  uint8_t cached[32], reference[32];
+  sighash(tx, 1, &cache, cached);
+  reference_sighash(tx, 1, reference);
+  EXPECT_EQ(memcmp(cached, reference, 32), 0);
+
+  // Not even an output with an empty script fits after that.
+  TxOutputBinType empty = output(1, 0, 0);
+  uint8_t byte;
+  EXPECT_EQ(tx_serialize_output_raw(&empty, &byte, 0), 0u);
+  uint8_t nine[9];
+  EXPECT_EQ(tx_serialize_output_raw(&empty, nine, 8), 0u);
+  EXPECT_EQ(tx_serialize_output_raw(&empty, nine, 9), 9u);
+}
+
+TEST(Transaction, OutputsCacheOverflowFallsBackToStreaming) {
+  // One byte more than the cache holds.
+  Tx tx = sample_tx();
+  tx.outputs.clear();
+  for (int i = 0; i < 3; i++) tx.outputs.push_back(output(i, 500, i));
+  tx.outputs.push_back(output(3, 505, 3));
+
+  std::vector<uint8_t> cache;
+  EXPECT_FALSE(cache_outputs(tx, &cache));
+
+  // Signing then streams the outputs, which still hash correctly.
+  HDNode node = signing_node();
+  for (size_t i = 0; i < tx.inputs.size(); i++) {
+    uint8_t streamed[32], reference[32];
+    sighash(tx, i, nullptr, streamed);
+    reference_sighash(tx, i, reference);
+    EXPECT_EQ(memcmp(streamed, reference, 32), 0) << i;
+
+    uint8_t sig[64];
+    ASSERT_EQ(hdnode_sign_digest(&node, streamed, sig, NULL, NULL), 0);
+    EXPECT_EQ(ecdsa_verify_digest(&secp256k1, node.public_key, sig, reference),
+              0);
+  }
+}
@@ -6,6 +6,10 @@ extern "C" {
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 extern "C" {
 void usb_rx_helper(const void *buf, size_t length, MessageMapType type);
 void set_msg_failure_handler(msg_failure_t failure_func);
@@ -94,3 +98,88 @@ TEST(USBRX, ErrorHandling) {
   ASSERT_EQ(failure_count, 4);
   ASSERT_EQ(message, "Unknown message");
 }
+
+static std::string streamed;
+static int stream_aborts;
+static bool ping_button_protection;
+
+static const MessageStream ping_stream = {
+    Ping_message_tag,
+    +[]() { streamed.clear(); },
+    +[](const uint8_t *buf, size_t len, uint32_t total) {
+      streamed.append((const char *)buf, len);
+      return streamed.size() <= total;
+    },
+    +[]() { stream_aborts++; },
+};
+
+static void send_ping(const uint8_t *payload, uint32_t len) {
+  uint8_t msg[64];
+  uint32_t off = 0;
+
+  memset(msg, 0, sizeof(msg));
+  msg[0] = '?';
+  msg[1] = '#';
+  msg[2] = '#';
+  msg[3] = 0;
+  msg[4] = MessageType_MessageType_Ping;
+  msg[5] = len >> 24;
+  msg[6] = len >> 16;
+  msg[7] = len >> 8;
+  msg[8] = len;
+  off = std::min<uint32_t>(len, sizeof(msg) - 9);
+  memcpy(&msg[9], payload, off);
+  usb_rx_helper(&msg, sizeof(msg), NORMAL_MSG);
+
+  while (off < len) {
+    uint32_t n = std::min<uint32_t>(len - off, sizeof(msg) - 1);
+    memset(msg, 0, sizeof(msg));
+    msg[0] = '?';
+    memcpy(&msg[1], &payload[off], n);
+    usb_rx_helper(&msg, sizeof(msg), NORMAL_MSG);
+    off += n;
+  }
+}
+
+TEST(USBRX, StreamedField) {
+  MessagesMap_t map[MessageType_MessageType_Ping + 1];
+  memset(map, 0, sizeof(map));
+  MessagesMap_t *entry = &map[MessageType_MessageType_Ping];
+  entry->msg_id = MessageType_MessageType_Ping;
+  entry->type = NORMAL_MSG;
+  entry->dir = IN_MSG;
+  entry->fields = Ping_fields;
+  entry->dispatch = PARSABLE;
+  entry->process_func = +[](void *ptr) {
+    ping_button_protection = ((Ping *)ptr)->button_protection;
+  };
+  entry->stream = &ping_stream;
+
+  msg_map_init(map, sizeof(map));
+  setup();
+  stream_aborts = 0;
+  ping_button_protection = false;
+
+  // message = 1000 bytes, split across fragments and around the field header,
+  // then button_protection = true.
+  std::vector<uint8_t> payload = {0x0a, 0xe8, 0x07};
+  for (int i = 0; i < 1000; i++) payload.push_back('a' + i % 26);
+  payload.push_back(0x10);
+  payload.push_back(0x01);
+
+  send_ping(payload.data(), payload.size());
+  ASSERT_EQ(failure_count, 0);
+  ASSERT_EQ(stream_aborts, 0);
+  ASSERT_TRUE(ping_button_protection);
+  ASSERT_EQ(streamed.size(), 1000u);
+  ASSERT_EQ(streamed, std::string((const char *)&payload[3], 1000));
+
+  // A message that ends inside the streamed field is rejected and aborted.
+  payload.resize(500);
+  send_ping(payload.data(), payload.size());
+  ASSERT_EQ(failure_count, 1);
+  ASSERT_EQ(message, "Malformed message");
+  ASSERT_EQ(stream_aborts, 1);
+
+  fsm_init();
+}